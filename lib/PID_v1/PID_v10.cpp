@@ -26,6 +26,7 @@ PID::PID(double* Input, double* Output, double* Setpoint,
 		mySetpoint = Setpoint;
 		SampleTime = 100000;							//default Controller Sample Time is 0.1 seconds
 		lastTime = micros() - SampleTime;
+		lastError = lastDInput = 0;
 
 		SetOutputLimits(0, 255);				//default output limit corresponds to
     SetControllerDirection(ControllerDirection);
@@ -44,13 +45,18 @@ void PID::Compute(unsigned long now)
    unsigned long timeChange = (now - lastTime);
    if(timeChange >= SampleTime)
    {
+      /*ki and kd are per SampleTime, scale them to the time that actually
+        passed, so calls at varying intervals integrate and differentiate
+        correctly*/
+      double ratio = (double)timeChange / (double)SampleTime;
+
       /*Compute all the working error variables*/
 	  double input = *myInput;
       double error = *mySetpoint - input;
-      ITerm+= (ki * error);
+      ITerm+= (ki * error * ratio);
       if(ITerm > outMax) ITerm= outMax;
       else if(ITerm < -outMax) ITerm= -outMax;
-      double dInput = (input - lastInput);
+      double dInput = (input - lastInput) / ratio;
 
       /*Compute PID Output*/
       double output = kp * error + ITerm- kd * dInput;
@@ -69,6 +75,8 @@ void PID::Compute(unsigned long now)
 
       /*Remember some variables for next time*/
       lastInput = input;
+      lastError = error;
+      lastDInput = dInput;
       lastTime = now;
    }
 }
@@ -77,6 +85,9 @@ void PID::Reset()
 {
 	ITerm = 0;
 	lastInput = *myInput;
+	lastError = 0;
+	lastDInput = 0;
+	lastTime = micros() - SampleTime;
 }
 
 
@@ -104,6 +115,20 @@ void PID::SetTunings(double Kp, double Ki, double Kd)
    }
 }
 
+/* Retune(...)****************************************************************
+ * Bumpless gain change: the integral term takes up the difference the new
+ * proportional and derivative gains would make to the last output, so the
+ * output carries on from where it was.
+ ******************************************************************************/
+void PID::Retune(double Kp, double Ki, double Kd)
+{
+   double oldKp = kp, oldKd = kd;
+   SetTunings(Kp, Ki, Kd);
+   ITerm += (oldKp - kp) * lastError - (oldKd - kd) * lastDInput;
+   if(ITerm > outMax) ITerm= outMax;
+   else if(ITerm < -outMax) ITerm= -outMax;
+}
+
 /* SetSampleTime(...) *********************************************************
  * sets the period, in Microseconds, at which the calculation is performed
  ******************************************************************************/
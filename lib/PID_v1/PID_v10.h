@@ -32,6 +32,8 @@ class PID
     void SetTunings(double, double,       // * While most users will set the tunings once in the
                     double);         	  //   constructor, this function gives the user the option
                                           //   of changing tunings during runtime for Adaptive control
+    void Retune(double, double, double);  // * same as SetTunings, but moves the integral term so
+                                          //   the output doesn't jump with the new gains
 	void SetControllerDirection(int);	  // * Sets the Direction, or "Action" of the controller. DIRECT
 										  //   means the output will increase when error is positive. REVERSE
 										  //   means the opposite.  it's very unlikely that this will be needed
@@ -72,6 +74,7 @@ private:
 
 	unsigned long lastTime;
 	double ITerm, lastInput;
+	double lastError, lastDInput;
 
 	long SampleTime;
 	double outMin, outMax;
@@ -0,0 +1,65 @@
+#include "Alloc.h"
+
+#ifdef ALLOC_COUNT
+
+static TaskHandle_t _counted = NULL;
+static volatile uint32_t _allocs = 0;
+
+extern "C" {
+	void * __real_malloc(size_t size);
+	void * __real_calloc(size_t n, size_t size);
+	void * __real_realloc(void * p, size_t size);
+
+	static inline void count() {
+		if (_counted && xTaskGetCurrentTaskHandle() == _counted)
+			_allocs++;
+	}
+
+	void * __wrap_malloc(size_t size) {
+		count();
+		return __real_malloc(size);
+	}
+
+	void * __wrap_calloc(size_t n, size_t size) {
+		count();
+		return __real_calloc(n, size);
+	}
+
+	void * __wrap_realloc(void * p, size_t size) {
+		count();
+		return __real_realloc(p, size);
+	}
+}
+
+void alloc_count_begin() {
+	_counted = xTaskGetCurrentTaskHandle();
+}
+
+uint32_t alloc_count() {
+	return _allocs;
+}
+
+AllocScope * AllocScope::_current = NULL;
+
+AllocScope::AllocScope(uint32_t& total) :
+	_total(total),
+	_start(_allocs),
+	// other tasks aren't counted, and must not touch the scope stack of the
+	// one that is
+	_active(_counted && xTaskGetCurrentTaskHandle() == _counted),
+	_parent(_active ? _current : NULL) {
+	if (_active)
+		_current = this;
+}
+
+AllocScope::~AllocScope() {
+	if (!_active)
+		return;
+	uint32_t n = _allocs - _start;
+	_total += n;
+	_current = _parent;
+	if (_parent)
+		_parent->_start += n;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <Arduino.h>
+
+// Heap allocation counting, to check that steady state control and
+// telemetry don't allocate. Build with
+//   -DALLOC_COUNT -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+// Only allocations from the task that called alloc_count_begin() (the
+// Arduino loop task) are counted, the network tasks allocate all the time.
+#ifdef ALLOC_COUNT
+
+void alloc_count_begin();
+
+uint32_t alloc_count();
+
+// Adds the allocations made in the enclosing scope to `total`. Scopes nest,
+// allocations are only charged to the innermost one. A scope on another
+// task than the counted one does nothing.
+class AllocScope {
+public:
+	AllocScope(uint32_t& total);
+	~AllocScope();
+private:
+	uint32_t& _total;
+	uint32_t _start;
+	bool _active;
+	AllocScope * _parent;
+	static AllocScope * _current;
+};
+
+#define ALLOC_SCOPE(total) AllocScope _alloc_scope(total)
+
+#else
+
+#define alloc_count_begin()
+#define ALLOC_SCOPE(total)
+
+#endif
+
+#endif
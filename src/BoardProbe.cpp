@@ -0,0 +1,48 @@
+#include "BoardProbe.h"
+#include "Config.h"
+
+BoardProbe::BoardProbe() :
+	_thermocouple(NULL),
+	_address(0) {
+}
+
+BoardProbe::~BoardProbe() {
+	delete _thermocouple;
+}
+
+void BoardProbe::begin(uint8_t clk, uint8_t data, uint8_t cs, uint8_t address, uint8_t sda, uint8_t scl) {
+	delete _thermocouple;
+	_thermocouple = NULL;
+	_address = 0;
+	if (cs) {
+		_thermocouple = new MAX31855(clk, cs, data);
+		_thermocouple->begin();
+		S_printf("Board probe: MAX31855 cs=%d", cs);
+	} else if (address) {
+		_address = address;
+		Wire.begin(sda, scl);
+		S_printf("Board probe: MLX90614 at 0x%02x", address);
+	}
+}
+
+float BoardProbe::read() {
+	if (_thermocouple) {
+		_thermocouple->read();
+		return _thermocouple->getTemperature();
+	}
+	if (!_address)
+		return NAN;
+
+	// SMBus read word: low byte, high byte, PEC
+	Wire.beginTransmission(_address);
+	Wire.write(MLX90614_TOBJ1);
+	if (Wire.endTransmission(false) != 0 || Wire.requestFrom(_address, (uint8_t)3) != 3)
+		return NAN;
+	uint16_t raw = Wire.read();
+	raw |= Wire.read() << 8;
+	Wire.read();
+	// the top bit flags an error
+	if (raw & 0x8000)
+		return NAN;
+	return raw * .02 - 273.15;
+}
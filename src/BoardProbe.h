@@ -0,0 +1,31 @@
+#ifndef BOARD_PROBE_H
+#define BOARD_PROBE_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <max31855.h>
+
+// object temperature register of the MLX90614
+#define MLX90614_TOBJ1 0x07
+
+// Temperature of the board itself, from a second thermocouple on the
+// shared MAX31855 bus or an MLX90614 IR sensor on SDA/SCL.
+class BoardProbe {
+public:
+	BoardProbe();
+	~BoardProbe();
+
+	// chip select of a MAX31855, or the I2C address of an MLX90614 (0 for none)
+	void begin(uint8_t clk, uint8_t data, uint8_t cs, uint8_t address, uint8_t sda, uint8_t scl);
+
+	bool present() const { return _thermocouple || _address; }
+
+	// NAN if there is no probe or the read failed
+	float read();
+
+private:
+	MAX31855 * _thermocouple;
+	uint8_t _address;
+};
+
+#endif
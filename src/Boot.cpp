@@ -0,0 +1,105 @@
+#include "Boot.h"
+
+typedef struct {
+	Boot::Stage_t * stage;
+	Boot::THandlerFunction_Stage fn;
+} BootTask_t;
+
+Boot::Boot() :
+	_count(0) {
+}
+
+int Boot::add(const char * name, bool background) {
+	if (_count >= BOOT_MAX_STAGES)
+		return -1;
+	Stage_t& s = _stages[_count];
+	s.name = name;
+	s.start = millis();
+	s.end = 0;
+	s.background = background;
+	return _count++;
+}
+
+void Boot::run(const char * name, THandlerFunction_Stage fn) {
+	int id = add(name, false);
+	fn();
+	if (id >= 0)
+		_stages[id].end = millis();
+}
+
+void Boot::task(void * arg) {
+	BootTask_t * t = (BootTask_t *)arg;
+	t->fn();
+	t->stage->end = millis();
+	delete t;
+	vTaskDelete(NULL);
+}
+
+void Boot::spawn(const char * name, THandlerFunction_Stage fn, uint32_t stack) {
+	int id = add(name, true);
+	if (id < 0) {
+		fn();
+		return;
+	}
+
+	BootTask_t * t = new BootTask_t;
+	t->stage = &_stages[id];
+	t->fn = fn;
+	if (xTaskCreate(Boot::task, name, stack, t, 1, NULL) != pdPASS) {
+		// no room for a task, fall back to running it in place
+		delete t;
+		fn();
+		_stages[id].end = millis();
+	}
+}
+
+void Boot::defer(const char * name, THandlerFunction_Ready ready, THandlerFunction_Stage fn) {
+	int id = add(name, true);
+	if (id < 0) {
+		fn();
+		return;
+	}
+	_ready[id] = ready;
+	_deferred[id] = fn;
+}
+
+void Boot::mark(const char * name) {
+	int id = add(name, false);
+	if (id >= 0)
+		_stages[id].end = _stages[id].start;
+}
+
+void Boot::loop(unsigned long now) {
+	for (int i = 0; i < _count; i++) {
+		if (!_deferred[i] || !_ready[i]())
+			continue;
+
+		_deferred[i]();
+		_stages[i].end = millis();
+		_deferred[i] = NULL;
+		_ready[i] = NULL;
+	}
+}
+
+bool Boot::done() {
+	for (int i = 0; i < _count; i++)
+		if (_stages[i].end == 0)
+			return false;
+	return true;
+}
+
+String Boot::toJSON() {
+	char str[96] = "";
+	String json = "{\"stages\": [";
+	for (int i = 0; i < _count; i++) {
+		unsigned long end = _stages[i].end;
+		sprintf(str, "%s{\"name\": \"%s\", \"start\": %lu, \"duration\": %ld, \"background\": %s}",
+			i ? ", " : "", _stages[i].name, _stages[i].start,
+			end ? (long)(end - _stages[i].start) : -1L, _stages[i].background ? "true" : "false");
+		json += str;
+	}
+	json += "], \"done\": ";
+	json += done() ? "true" : "false";
+	json += "}";
+	return json;
+}
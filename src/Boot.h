@@ -0,0 +1,52 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <Arduino.h>
+
+#define BOOT_MAX_STAGES 12
+
+class Boot {
+public:
+	typedef std::function<void()> THandlerFunction_Stage;
+	typedef std::function<bool()> THandlerFunction_Ready;
+
+	typedef struct {
+		const char * name;
+		unsigned long start;
+		volatile unsigned long end;
+		bool background;
+	} Stage_t;
+
+	Boot();
+
+	// run a stage in place, timing it
+	void run(const char * name, THandlerFunction_Stage fn);
+
+	// run a stage as a FreeRTOS task, so setup() can carry on
+	void spawn(const char * name, THandlerFunction_Stage fn, uint32_t stack = 2048);
+
+	// run a stage from loop() as soon as ready() says so
+	void defer(const char * name, THandlerFunction_Ready ready, THandlerFunction_Stage fn);
+
+	// record a point in time (e.g. first control tick)
+	void mark(const char * name);
+
+	void loop(unsigned long now);
+
+	bool done();
+
+	String toJSON();
+
+private:
+	Stage_t _stages[BOOT_MAX_STAGES];
+	uint8_t _count;
+
+	THandlerFunction_Ready _ready[BOOT_MAX_STAGES];
+	THandlerFunction_Stage _deferred[BOOT_MAX_STAGES];
+
+	int add(const char * name, bool background);
+
+	static void task(void * arg);
+};
+
+#endif
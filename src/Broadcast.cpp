@@ -0,0 +1,169 @@
+#include "Broadcast.h"
+#include "Config.h"
+#include "Metrics.h"
+#include "Alloc.h"
+#include "Trace.h"
+
+Broadcast::Broadcast(AsyncWebSocket& ws) :
+	_ws(ws),
+	_last_event(0) {
+	portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+	_mux = mux;
+	memset(_clients, 0, sizeof(_clients));
+	memset(_states, 0, sizeof(_states));
+	memset(_events, 0, sizeof(_events));
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+bool Broadcast::fits(const char * frame) {
+	// cut off, it wouldn't be JSON any more; FrameWriter cuts the text
+	// inside the frame instead
+	if (strnlen(frame, FRAME_SIZE) < FRAME_SIZE)
+		return true;
+	_stats.oversize++;
+	metrics.dropped++;
+	return false;
+}
+
+void Broadcast::state(STATE_t kind, const char * frame) {
+	if (!fits(frame))
+		return;
+	portENTER_CRITICAL(&_mux);
+	Slot_t& s = _states[kind];
+	strcpy(s.frame, frame);
+	s.version++;
+	portEXIT_CRITICAL(&_mux);
+}
+
+void Broadcast::event(const char * frame) {
+	if (!fits(frame))
+		return;
+	portENTER_CRITICAL(&_mux);
+	uint32_t id = _last_event + 1;
+	Slot_t& s = _events[id % BROADCAST_EVENTS];
+	strcpy(s.frame, frame);
+	s.version = id;
+	_last_event = id;
+	portEXIT_CRITICAL(&_mux);
+}
+
+bool Broadcast::connect(AsyncWebSocketClient * client) {
+	portENTER_CRITICAL(&_mux);
+	for (int i = 0; i < BROADCAST_CLIENTS; i++) {
+		Client_t& c = _clients[i];
+		if (c.id != 0)
+			continue;
+		c.id = client->id();
+		for (int k = 0; k < STATES; k++)
+			c.versions[k] = _states[k].version;
+		c.next_event = _last_event + 1;
+		c.over_since = 0;
+		portEXIT_CRITICAL(&_mux);
+		return true;
+	}
+	_stats.rejected++;
+	portEXIT_CRITICAL(&_mux);
+	return false;
+}
+
+void Broadcast::disconnect(uint32_t id) {
+	portENTER_CRITICAL(&_mux);
+	for (int i = 0; i < BROADCAST_CLIENTS; i++)
+		if (_clients[i].id == id)
+			_clients[i].id = 0;
+	portEXIT_CRITICAL(&_mux);
+}
+
+uint32_t Broadcast::copy(Slot_t& slot, char * frame) {
+	portENTER_CRITICAL(&_mux);
+	uint32_t version = slot.version;
+	memcpy(frame, slot.frame, FRAME_SIZE);
+	portEXIT_CRITICAL(&_mux);
+	return version;
+}
+
+void Broadcast::send(AsyncWebSocketClient * client, const char * frame) {
+	TRACE_SCOPE("ws_send");
+	// the socket library queues a copy per client
+	ALLOC_SCOPE(metrics.alloc_socket);
+	client->text(frame);
+	metrics.messages++;
+	_stats.sent++;
+}
+
+void Broadcast::flush(Client_t& c, AsyncWebSocketClient * client) {
+	char frame[FRAME_SIZE];
+
+	// events first and in order; a client that fell behind by more than
+	// the ring holds loses the oldest ones
+	while (c.next_event <= _last_event && client->queueLen() < BROADCAST_BUDGET) {
+		uint32_t behind = _last_event - c.next_event + 1;
+		if (behind > BROADCAST_EVENTS) {
+			_stats.events_lost += behind - BROADCAST_EVENTS;
+			metrics.dropped += behind - BROADCAST_EVENTS;
+			c.next_event += behind - BROADCAST_EVENTS;
+			continue;
+		}
+		if (copy(_events[c.next_event % BROADCAST_EVENTS], frame) != c.next_event)
+			continue;	// overwritten while we looked, the loop above catches it
+		send(client, frame);
+		c.next_event++;
+	}
+
+	for (int k = 0; k < STATES && client->queueLen() < BROADCAST_BUDGET; k++) {
+		if (c.versions[k] == _states[k].version)
+			continue;
+		uint32_t version = copy(_states[k], frame);
+		send(client, frame);
+		_stats.coalesced += version - c.versions[k] - 1;
+		c.versions[k] = version;
+	}
+}
+
+void Broadcast::loop(unsigned long now) {
+	for (int i = 0; i < BROADCAST_CLIENTS; i++) {
+		Client_t& c = _clients[i];
+		if (c.id == 0)
+			continue;
+		AsyncWebSocketClient * client = _ws.client(c.id);
+		if (!client || client->status() != WS_CONNECTED)
+			continue;
+
+		if (client->queueLen() >= BROADCAST_BUDGET) {
+			if (c.over_since == 0) {
+				c.over_since = now;
+			} else if (now - c.over_since > BROADCAST_TIMEOUT) {
+				S_printf("Client %u over budget for %lu ms, disconnecting", c.id, now - c.over_since);
+				_stats.disconnects++;
+				c.id = 0;
+				client->close();
+			}
+			continue;
+		}
+		c.over_since = 0;
+
+		MetricsTimer t(metrics.broadcast);
+		flush(c, client);
+	}
+}
+
+String Broadcast::toJSON(unsigned long now) {
+	char str[192] = "";
+	sprintf(str, "{\"sent\": %u, \"coalesced\": %u, \"events_lost\": %u, \"disconnects\": %u, \"rejected\": %u, \"oversize\": %u, \"clients\": [",
+		_stats.sent, _stats.coalesced, _stats.events_lost, _stats.disconnects, _stats.rejected, _stats.oversize);
+	String json = str;
+	bool first = true;
+	for (int i = 0; i < BROADCAST_CLIENTS; i++) {
+		Client_t& c = _clients[i];
+		AsyncWebSocketClient * client = c.id ? _ws.client(c.id) : NULL;
+		if (!client)
+			continue;
+		sprintf(str, "%s{\"id\": %u, \"queue\": %u, \"events_behind\": %u, \"over_budget_ms\": %lu}",
+			first ? "" : ", ", c.id, (unsigned)client->queueLen(), _last_event + 1 - c.next_event,
+			c.over_since ? now - c.over_since : 0);
+		json += str;
+		first = false;
+	}
+	json += "]}";
+	return json;
+}
@@ -0,0 +1,88 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "Frames.h"
+
+#define BROADCAST_CLIENTS 8
+// frames we let queue up in a client's socket before holding back
+#define BROADCAST_BUDGET 8
+// a client over budget for this long is disconnected
+#define BROADCAST_TIMEOUT 10000
+// events kept for clients that are behind
+#define BROADCAST_EVENTS 8
+
+// Fans frames out to the WebSocket clients without letting a slow one pile
+// up memory. State frames (the latest reading, mode, heater, ...) only keep
+// their newest copy: a client that is behind gets that one and skips the
+// ones in between. Events are kept in a ring and sent in order as the
+// client catches up. post from any task, flush from loop().
+class Broadcast {
+public:
+	typedef enum {
+		READING,
+		MODE,
+		HEATER,
+		TARGET,
+		DEBUG,
+		STATES
+	} STATE_t;
+
+	Broadcast(AsyncWebSocket& ws);
+
+	void state(STATE_t kind, const char * frame);
+
+	void event(const char * frame);
+
+	// a new client starts at the current state, it gets a snapshot anyway
+	bool connect(AsyncWebSocketClient * client);
+	void disconnect(uint32_t id);
+
+	void loop(unsigned long now);
+
+	String toJSON(unsigned long now);
+
+private:
+	typedef struct {
+		uint32_t id;
+		uint32_t versions[STATES];
+		uint32_t next_event;
+		unsigned long over_since;
+	} Client_t;
+
+	typedef struct {
+		uint32_t version;
+		char frame[FRAME_SIZE];
+	} Slot_t;
+
+	AsyncWebSocket& _ws;
+	portMUX_TYPE _mux;
+
+	Client_t _clients[BROADCAST_CLIENTS];
+	Slot_t _states[STATES];
+	// event n is in _events[n % BROADCAST_EVENTS]
+	Slot_t _events[BROADCAST_EVENTS];
+	uint32_t _last_event;
+
+	struct {
+		uint32_t sent;
+		uint32_t coalesced;
+		uint32_t events_lost;
+		uint32_t disconnects;
+		uint32_t rejected;
+		uint32_t oversize;
+	} _stats;
+
+	// false for a frame that doesn't fit a slot, which is then dropped
+	bool fits(const char * frame);
+
+	// copies a slot out under the lock, the socket is written without it
+	uint32_t copy(Slot_t& slot, char * frame);
+
+	void send(AsyncWebSocketClient * client, const char * frame);
+
+	void flush(Client_t& c, AsyncWebSocketClient * client);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "Cascade.h"
+
+Cascade::Cascade() :
+	_P(0), _I(0), _D(0),
+	_margin(CASCADE_MARGIN),
+	_interval(CASCADE_INTERVAL),
+	_temperature(NAN),
+	_rate(0),
+	_last_m(0),
+	_last_temperature(NAN),
+	_offset(0),
+	_integral(0),
+	_last_input(NAN),
+	_last_compute(0),
+	_reset(true) {
+}
+
+void Cascade::begin(float P, float I, float D, unsigned long interval, float margin) {
+	_P = P;
+	_I = I;
+	_D = D;
+	_margin = margin > 0 ? margin : CASCADE_MARGIN;
+	_interval = interval ? interval : CASCADE_INTERVAL;
+}
+
+void Cascade::measure(unsigned long now, float temperature) {
+	_temperature = temperature;
+	if (isnan(temperature)) {
+		_last_temperature = NAN;
+		return;
+	}
+	if (!isnan(_last_temperature) && now != _last_m) {
+		double rate = 1000.0 * (temperature - _last_temperature) / (now - _last_m);
+		_rate += (rate - _rate) * CASCADE_RATE_AVERAGE;
+	}
+	_last_m = now;
+	_last_temperature = temperature;
+}
+
+void Cascade::reset(unsigned long now) {
+	_offset = 0;
+	_rate = 0;
+	_reset = true;
+}
+
+double Cascade::compute(unsigned long now, double target, double plate, double inner) {
+	if (isnan(_temperature))
+		return target;
+	if (_reset) {
+		_integral = 0;
+		_last_input = _temperature;
+		_last_compute = now - _interval;
+		_reset = false;
+	}
+	if (now - _last_compute < _interval)
+		return target + _offset;
+
+	double dt = (now - _last_compute) / 1000.0;
+	double error = target - _temperature;
+	// conditional integration: a saturated plate can't follow a setpoint
+	// further out, so that part of the error isn't summed up
+	double setpoint = target + _offset;
+	bool high = inner >= 1 - CASCADE_SATURATED && plate < setpoint - CASCADE_BEHIND && error > 0;
+	bool low = inner <= CASCADE_SATURATED && plate > setpoint + CASCADE_BEHIND && error < 0;
+	if (!high && !low)
+		_integral = constrain(_integral + _I * error * dt, -_margin, _margin);
+	double derivative = (_temperature - _last_input) / dt;
+	_offset = constrain(_P * error + _integral - _D * derivative, -_margin, _margin);
+
+	_last_input = _temperature;
+	_last_compute = now;
+	return target + _offset;
+}
@@ -0,0 +1,65 @@
+#ifndef CASCADE_H
+#define CASCADE_H
+
+#include <Arduino.h>
+
+// outer loop defaults: ms between two computations, and how far the plate
+// may be set above or below the board target, in C
+#define CASCADE_INTERVAL 2000
+#define CASCADE_MARGIN 50.0
+// the plate can't follow its setpoint while the inner output is this close
+// to 0 or 1 and the plate is more than CASCADE_BEHIND C off the setpoint
+#define CASCADE_SATURATED .01
+#define CASCADE_BEHIND 2.0
+// weight of a new board rate, per outer interval
+#define CASCADE_RATE_AVERAGE .3
+
+// Outer loop of a cascade: a PID on the board temperature whose output is
+// the plate setpoint, as an offset from the board target within
+// +-margin. The plate's own PID stays the inner loop and runs at its own
+// rate. While the inner loop is saturated, the outer integral doesn't
+// move further in the direction the plate can't follow, so neither loop
+// winds up against the other.
+class Cascade {
+public:
+	Cascade();
+
+	// gains per second, like the PID library's
+	void begin(float P, float I, float D, unsigned long interval, float margin);
+
+	// time for the next board reading
+	bool due(unsigned long now) const { return isnan(_last_temperature) || now - _last_m >= _interval; }
+
+	// a new board reading, NAN when the probe failed
+	void measure(unsigned long now, float temperature);
+
+	// start of a heating mode, the plate starts at the board target
+	void reset(unsigned long now);
+
+	// plate setpoint for the board target, given the plate temperature and
+	// the inner loop's output; the offset only changes once per interval
+	double compute(unsigned long now, double target, double plate, double inner);
+
+	double temperature() const { return _temperature; }
+	double rate() const { return _rate; }
+	double offset() const { return _offset; }
+
+private:
+	float _P, _I, _D;
+	float _margin;
+	unsigned long _interval;
+
+	double _temperature;
+	double _rate;
+	unsigned long _last_m;
+	double _last_temperature;
+
+	double _offset;
+	double _integral;
+	double _last_input;
+	unsigned long _last_compute;
+	// the next computation starts over
+	bool _reset;
+};
+
+#endif
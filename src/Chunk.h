@@ -0,0 +1,49 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <stdarg.h>
+
+// Output of a chunked response, one piece (a header, a line) at a time. A
+// piece is formatted whole into a small buffer and copied out as far as
+// the chunk has room; what is left goes out first in the next chunk, so
+// any maxLen works and nothing is written past the chunk or cut off.
+template<size_t N>
+class Chunk {
+public:
+	Chunk() : _len(0), _pos(0) {}
+
+	bool empty() const { return _pos >= _len; }
+
+	// the next piece, once the last one is out; a longer one is cut at N - 1
+	void printf(const char * format, ...) {
+		va_list args;
+		va_start(args, format);
+		int n = vsnprintf(_buf, N, format, args);
+		va_end(args);
+		_len = n < 0 ? 0 : min((size_t)n, N - 1);
+		_pos = 0;
+	}
+
+	// copies what fits of the pending piece, returns how much
+	size_t drain(char * out, size_t room) {
+		size_t n = min(room, _len - _pos);
+		memcpy(out, _buf + _pos, n);
+		_pos += n;
+		return n;
+	}
+
+	// 0 ends the response, so an empty chunk before the end asks to be
+	// called again
+	static size_t result(size_t len, bool done) {
+		return len || done ? len : RESPONSE_TRY_AGAIN;
+	}
+
+private:
+	char _buf[N];
+	size_t _len;
+	size_t _pos;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "Coast.h"
+#include "ControllerBase.h"
+
+Coast::Coast() :
+	_gain(DEFAULT_TEMP_RISE_AFTER_OFF / COAST_REFERENCE_RATE),
+	_rise(NAN),
+	_observed(NAN),
+	_tracking(false),
+	_off_temperature(0),
+	_off_rate(0),
+	_peak(0) {
+}
+
+void Coast::start(float temperature, float rate) {
+	if (_tracking || rate < COAST_MIN_RATE)
+		return;
+	_tracking = true;
+	_off_temperature = _peak = temperature;
+	_off_rate = rate;
+}
+
+bool Coast::update(float temperature, float rate) {
+	if (!_tracking)
+		return false;
+	_peak = max(_peak, temperature);
+	if (rate > 0)
+		return false;
+
+	_tracking = false;
+	_rise = _peak - _off_temperature;
+	_observed = _rise / _off_rate;
+	_gain += (_observed - _gain) * COAST_LEARN;
+	return true;
+}
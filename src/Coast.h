@@ -0,0 +1,51 @@
+#ifndef COAST_H
+#define COAST_H
+
+#include <Arduino.h>
+
+// rise rate the default coast was seen at, DEFAULT_TEMP_RISE_AFTER_OFF at
+// this rate gives the initial model
+#define COAST_REFERENCE_RATE 2.0
+// slower rises don't coast enough to learn from, in C/s
+#define COAST_MIN_RATE 0.3
+// weight of a new observation
+#define COAST_LEARN .3
+
+// How far the oven keeps climbing after the heater goes off. The coast is
+// modelled as proportional to the rise rate at switch off, the factor (in
+// seconds) is learned from every off period that runs until the
+// temperature turns: coast = (peak - temperature at off) / rate at off.
+class Coast {
+public:
+	Coast();
+
+	// predicted rise still to come if the heater went off now
+	float predict(float rate) const { return rate > 0 ? _gain * rate : 0; }
+
+	// true once the heat already in the oven is enough to get to target
+	bool cut(float temperature, float rate, float target) const { return temperature + predict(rate) >= target; }
+
+	// the heater went off for good, follow the temperature to its peak
+	void start(float temperature, float rate);
+	// the heater came back on, the observation is worthless
+	void abort() { _tracking = false; }
+	// true when an observation completed and the model was updated
+	bool update(float temperature, float rate);
+
+	bool tracking() const { return _tracking; }
+	float gain() const { return _gain; }
+	// last completed observation, as rise in C and as factor
+	float rise() const { return _rise; }
+	float observed() const { return _observed; }
+
+private:
+	float _gain;
+	float _rise;
+	float _observed;
+	bool _tracking;
+	float _off_temperature;
+	float _off_rate;
+	float _peak;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "Commands.h"
+#include <ArduinoJson.h>
+#include "Frames.h"
+
+Commands::Commands() :
+	_reserve(NULL),
+	_commit(NULL),
+	_received(0),
+	_rejected(0) {
+	for (int i = 0; i < COMMANDS_SLOTS; i++) {
+		_table[i].name = NULL;
+		_table[i].len = 0;
+	}
+}
+
+// FNV-1a
+uint32_t Commands::hash(const char * name, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (uint8_t)name[i]) * 16777619u;
+	return h;
+}
+
+bool Commands::on(const char * name, THandlerFunction_Run run, THandlerFunction_Check check) {
+	size_t len = strlen(name);
+	uint32_t h = hash(name, len);
+	for (int i = 0; i < COMMANDS_SLOTS; i++) {
+		Entry_t& e = _table[(h + i) % COMMANDS_SLOTS];
+		if (e.name && (e.len != len || memcmp(e.name, name, len) != 0))
+			continue;
+		e.name = name;
+		e.len = len;
+		e.run = run;
+		e.check = check;
+		return true;
+	}
+	return false;
+}
+
+Commands::Entry_t * Commands::find(const char * cmd, const char ** arg) {
+	size_t len = strcspn(cmd, ":");
+	*arg = cmd[len] == ':' ? cmd + len + 1 : "";
+	uint32_t h = hash(cmd, len);
+	for (int i = 0; i < COMMANDS_SLOTS; i++) {
+		Entry_t& e = _table[(h + i) % COMMANDS_SLOTS];
+		if (!e.name)
+			return NULL;
+		if (e.len == len && memcmp(e.name, cmd, len) == 0)
+			return &e;
+	}
+	return NULL;
+}
+
+const char * Commands::check(const char * cmd) {
+	const char * arg;
+	if (!cmd)
+		return "Command is not a string";
+	Entry_t * e = find(cmd, &arg);
+	if (!e)
+		return "Unknown command";
+	return e->check ? e->check(arg) : NULL;
+}
+
+void Commands::run(AsyncWebSocketClient * client, const char * cmd) {
+	const char * arg;
+	Entry_t * e = find(cmd, &arg);
+	if (e)
+		e->run(client, arg);
+}
+
+void Commands::handle(AsyncWebSocketClient * client, char * frame) {
+	_received++;
+	if (frame[0] == '{') {
+		batch(client, frame);
+		return;
+	}
+
+	const char * error = check(frame);
+	if (!error && _reserve)
+		error = _reserve(1);
+	if (error) {
+		_rejected++;
+		Frame reply;
+		char str[96];
+		snprintf(str, sizeof(str), "ERROR: %s: %.32s", error, frame);
+		client->text(reply.message(str));
+		return;
+	}
+	run(client, frame);
+	if (_commit)
+		_commit();
+}
+
+void Commands::batch(AsyncWebSocketClient * client, char * frame) {
+	unsigned long start = micros();
+	Frame reply;
+
+	// parsing in place, the strings below point into frame
+	StaticJsonBuffer<COMMANDS_JSON> jsonBuffer;
+	JsonObject &root = jsonBuffer.parseObject(frame);
+	if (!root.success()) {
+		_rejected++;
+		client->text(reply.nack(0, NAN, -1, "Malformed batch"));
+		return;
+	}
+
+	unsigned long id = root["id"];
+	double t = root.containsKey("t") ? root["t"].as<double>() : NAN;
+
+	const char * cmds[COMMANDS_BATCH];
+	size_t n = 0;
+	if (root.containsKey("cmd"))
+		cmds[n++] = root["cmd"].as<const char*>();
+	JsonArray& list = root["batch"];
+	if (list.size() + n > COMMANDS_BATCH) {
+		_rejected++;
+		client->text(reply.nack(id, t, COMMANDS_BATCH, "Batch too large"));
+		return;
+	}
+	for (size_t i = 0; i < list.size(); i++)
+		cmds[n++] = list[i].as<const char*>();
+
+	for (size_t i = 0; i < n; i++) {
+		const char * error = check(cmds[i]);
+		if (error) {
+			_rejected++;
+			client->text(reply.nack(id, t, i, error));
+			return;
+		}
+	}
+	const char * error = _reserve ? _reserve(n) : NULL;
+	if (error) {
+		_rejected++;
+		client->text(reply.nack(id, t, -1, error));
+		return;
+	}
+	for (size_t i = 0; i < n; i++)
+		run(client, cmds[i]);
+	if (_commit)
+		_commit();
+
+	client->text(reply.ack(id, t, micros() - start));
+}
@@ -0,0 +1,67 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <functional>
+
+// hash table slots, a power of two well above the number of commands
+#define COMMANDS_SLOTS 64
+#define COMMANDS_BATCH 8
+#define COMMANDS_JSON 512
+
+// WebSocket commands by name. A frame is either a plain command,
+// `NAME` or `name:argument`, or a JSON batch
+//   {"id": 7, "t": 1234.5, "batch": ["profile:lead-free", "target:150", "REFLOW"]}
+// ({"cmd": "ON"} for a single one). All commands of a batch are checked
+// before the first one runs; the sender gets
+//   {"ack":7,"t":1234.5,"ok":true,"us":412}
+// or, with nothing run, {"ack":7,"t":1234.5,"ok":false,"index":1,"error":"..."}
+// with `t` echoed so it can work out the round trip. An ack means the
+// controller has the commands, they take effect together at its next tick.
+class Commands {
+public:
+	// returns why the command can't run, NULL if it can
+	typedef std::function<const char *(const char * arg)> THandlerFunction_Check;
+	typedef std::function<void(AsyncWebSocketClient * client, const char * arg)> THandlerFunction_Run;
+	// room for n commands before a frame runs, and the end of the frame
+	typedef std::function<const char *(size_t n)> THandlerFunction_Reserve;
+	typedef std::function<void()> THandlerFunction_Commit;
+
+	Commands();
+
+	bool on(const char * name, THandlerFunction_Run run, THandlerFunction_Check check = NULL);
+
+	void onFrame(THandlerFunction_Reserve reserve, THandlerFunction_Commit commit) { _reserve = reserve; _commit = commit; }
+
+	void handle(AsyncWebSocketClient * client, char * frame);
+
+	uint32_t received() { return _received; }
+	uint32_t rejected() { return _rejected; }
+
+private:
+	typedef struct {
+		const char * name;
+		size_t len;
+		THandlerFunction_Run run;
+		THandlerFunction_Check check;
+	} Entry_t;
+
+	Entry_t _table[COMMANDS_SLOTS];
+	THandlerFunction_Reserve _reserve;
+	THandlerFunction_Commit _commit;
+	uint32_t _received;
+	uint32_t _rejected;
+
+	static uint32_t hash(const char * name, size_t len);
+
+	Entry_t * find(const char * cmd, const char ** arg);
+
+	const char * check(const char * cmd);
+
+	void run(AsyncWebSocketClient * client, const char * cmd);
+
+	void batch(AsyncWebSocketClient * client, char * frame);
+};
+
+#endif
@@ -1,44 +1,182 @@
 #include "Config.h"
 
+Config::Stage::Stage() :
+ target(0), rate(0), stay(0) {
+	for (int i = 0; i < ZONES_MAX; i++)
+		zones[i] = NAN;
+}
+
 Config::Stage::Stage(const char * n, const char * p, float t, float r, float s) :
  name(n), pid(p), target(t), rate(r), stay(s) {
+	for (int i = 0; i < ZONES_MAX; i++)
+		zones[i] = NAN;
 }
 
-Config::Profile::Profile(JsonObject& json)
+bool Config::Profile::load(const char * key, JsonObject& json)
 {
 	char str[255] = "";
-	stages.reserve(5);
 
+	id = key;
 	name = json["name"].as<char*>();
+	retune = json["retune"];
+	stages.clear();
+	program.clear();
+	JsonObject& abort = json["abort"];
+	if (abort.containsKey("above"))
+		program.emit(Program::ABOVE, 0, 0, abort["above"]);
+
+	uint16_t stage_pc[PROFILE_STAGES];
+	uint8_t counters = 0;
 	JsonArray& jo = json["stages"];
 	JsonArray::iterator I = jo.begin();
 	while (I != jo.end())
 	{
 		const char * stage_name = I->as<char*>();
 		JsonObject &stage = json[stage_name];
-		Stage s(
+		Stage * s = stages.add();
+		if (!s) {
+			sprintf(str, "Profile %s: more than %d stages, ignoring the rest", key, PROFILE_STAGES);
+			Serial.println(str);
+			program.emit(Program::END);
+			return false;
+		}
+		*s = Stage(
 			stage_name,
 			stage["pid"].as<char*>(),
 			stage["target"],
 			stage["rate"],
 			stage["stay"]
 		);
-		stages.push_back(s);
-		sprintf(str, "Profile stage: %s, t=%f, r=%f, s=%f", s.name.c_str(), s.target, s.rate, s.stay);
+		JsonArray& zones = stage["zones"];
+		for (size_t i = 0; i < zones.size() && i < ZONES_MAX; i++)
+			s->zones[i] = zones[i].as<float>();
+		sprintf(str, "Profile stage: %s, t=%f, r=%f, s=%f", s->name.c_str(), s->target, s->rate, s->stay);
 		Serial.println(str);
+		if (!compile(key, stages.size() - 1, stage, stage_pc, counters)) {
+			// a run must not go on with a stage half done
+			S_printf("Profile %s: program longer than %d instructions, stopping after '%s'", key, PROGRAM_SIZE, stage_name);
+			program.size = stage_pc[stages.size() - 1];
+			stages.pop();
+			program.emit(Program::END);
+			return false;
+		}
 		++I;
 	}
+	S_printf("Profile %s: %u instructions", key, program.size);
+	return program.emit(Program::END);
+}
+
+// STAGE n; [TIMEOUT s]; REACH target; STAY s; [RATE r]; [ZONE z, d]; [LOOP c, to, n]
+// from the stage's "timeout", "until": {"rate": r, "zone": [z, d]} and
+// "repeat": ["earlier stage", times]
+bool Config::Profile::compile(const char * key, uint8_t index, JsonObject& stage, uint16_t * stage_pc, uint8_t& counters)
+{
+	const Stage& s = stages.begin()[index];
+	stage_pc[index] = program.size;
+	bool ok = program.emit(Program::STAGE, index);
+	if (stage.containsKey("timeout"))
+		ok = ok && program.emit(Program::TIMEOUT, 0, 0, stage["timeout"]);
+	ok = ok && program.emit(Program::REACH, 0, 0, s.target);
+	ok = ok && program.emit(Program::STAY, 0, 0, s.stay);
+
+	JsonObject& until = stage["until"];
+	if (until.containsKey("rate"))
+		ok = ok && program.emit(Program::RATE, 0, 0, until["rate"]);
+	if (until.containsKey("zone")) {
+		JsonArray& zone = until["zone"];
+		int z = zone[0];
+		if (z >= 0 && z < ZONES_MAX)
+			ok = ok && program.emit(Program::ZONE, z, 0, zone[1]);
+		else
+			S_printf("Profile %s: stage '%s' waits for zone %d, there are at most %d", key, s.name.c_str(), z, ZONES_MAX);
+	}
+
+	JsonArray& repeat = stage["repeat"];
+	if (repeat.size() == 2) {
+		const char * to = repeat[0];
+		int target = -1;
+		for (int i = 0; i <= index; i++)
+			if (to && stages.begin()[i].name == to)
+				target = i;
+		if (target < 0)
+			S_printf("Profile %s: stage '%s' repeats from '%s', which is not an earlier stage", key, s.name.c_str(), to ? to : "");
+		else if (counters == PROGRAM_COUNTERS)
+			S_printf("Profile %s: more than %d repeats, ignoring '%s'", key, PROGRAM_COUNTERS, s.name.c_str());
+		else
+			ok = ok && program.emit(Program::LOOP, counters++, stage_pc[target], repeat[1]);
+	}
+	return ok;
+}
+
+bool Config::Schedule::load(const char * key, JsonArray& json, Config * config)
+{
+	id = key;
+	count = 0;
+	for (size_t i = 0; i < json.size(); i++) {
+		if (count == SCHEDULE_POINTS) {
+			S_printf("Schedule %s: more than %d points, ignoring the rest", key, SCHEDULE_POINTS);
+			break;
+		}
+		// [temperature, "PID set"] or [temperature, P, I, D]
+		JsonArray& point = json[i];
+		Point_t p;
+		p.temperature = point[0];
+		if (point[1].is<const char*>()) {
+			PID_t * pid = config->pid.find(point[1].as<const char*>());
+			if (pid == config->pid.end()) {
+				S_printf("Schedule %s: no PID named '%s', skipping the point", key, point[1].as<const char*>());
+				continue;
+			}
+			p.P = pid->P;
+			p.I = pid->I;
+			p.D = pid->D;
+		} else {
+			p.P = point[1];
+			p.I = point[2];
+			p.D = point[3];
+		}
+
+		uint8_t at = count++;
+		for (; at > 0 && points[at - 1].temperature > p.temperature; at--)
+			points[at] = points[at - 1];
+		points[at] = p;
+		S_printf("Schedule %s: %.1f*C [%f, %f, %f]", key, p.temperature, p.P, p.I, p.D);
+	}
+	return count > 0;
 }
 
-Config::Config(const String& cfg, const String& profiles) :
+void Config::Schedule::at(float temperature, float& P, float& I, float& D) const
+{
+	if (count == 0)
+		return;
+	uint8_t i = 0;
+	while (i < count && points[i].temperature < temperature)
+		i++;
+	// flat outside the table
+	if (i == 0 || i == count) {
+		const Point_t& p = points[i == 0 ? 0 : count - 1];
+		P = p.P; I = p.I; D = p.D;
+		return;
+	}
+	const Point_t& a = points[i - 1];
+	const Point_t& b = points[i];
+	float f = (temperature - a.temperature) / (b.temperature - a.temperature);
+	P = a.P + (b.P - a.P) * f;
+	I = a.I + (b.I - a.I) * f;
+	D = a.D + (b.D - a.D) * f;
+}
+
+Config::Config(const char * cfg, const char * profiles) :
 	cfgName(cfg),
-	profilesName(profiles) {
+	profilesName(profiles),
+	zone_count(0) {
+	memset(&board, 0, sizeof(board));
 }
 
 bool Config::load_config() {
 	return load_json(cfgName, 1024, [](JsonObject& json, Config* self){
 		char str[255] = "";
-		self->networks.empty();
+		self->networks.clear();
 		self->hostname = json["hostname"].as<char*>();
 		self->user = json["user"].as<char*>();
 		self->password = json["password"].as<char*>();
@@ -59,12 +197,47 @@ bool Config::load_config() {
 		JsonObject::iterator I = jo.begin();
 		while (I != jo.end())
 		{
-			self->networks.insert(std::pair<String, String>(I->key, I->value.as<char*>()));
+			Network_t * n = self->networks.add();
+			if (!n)
+				break;
+			n->id = I->key;
+			n->password = I->value.as<char*>();
 
 			sprintf(str, "Config network: %s @ %s", I->key, I->value.as<char*>());
 			Serial.println(str);
 			++I;
 		}
+
+		self->zone_count = 0;
+		JsonArray& zones = json["zones"];
+		JsonArray::iterator Z = zones.begin();
+		while (Z != zones.end() && self->zone_count < ZONES_MAX)
+		{
+			Zone_t& z = self->zones[self->zone_count++];
+			z.name = (*Z)["name"].as<char*>();
+			z.cs = (*Z)["cs"].as<int>();
+			z.relay = (*Z)["relay"].as<int>();
+
+			sprintf(str, "Config zone: %s cs=%d relay=%d", z.name.c_str(), z.cs, z.relay);
+			Serial.println(str);
+			++Z;
+		}
+
+		JsonObject& board = json["board"];
+		Board_t& b = self->board;
+		b.cs = board["cs"].as<int>();
+		b.address = board["mlx90614"].as<int>();
+		JsonArray& pid = board["pid"];
+		b.P = pid[0];
+		b.I = pid[1];
+		b.D = pid[2];
+		b.interval = board["interval"].as<int>();
+		b.margin = board["margin"];
+		if (b.cs || b.address) {
+			sprintf(str, "Config board probe: cs=%d mlx90614=%d [%f, %f, %f] every %d ms, +-%.0f*C",
+				b.cs, b.address, b.P, b.I, b.D, b.interval, b.margin);
+			Serial.println(str);
+		}
 		return true;
 	});
 }
@@ -78,14 +251,36 @@ bool Config::load_profiles() {
 		I = pid.begin();
 		while (I != pid.end())
 		{
-			PID_t p = {
-				I->value[0],
-				I->value[1],
-				I->value[2],
-			};
-			self->pid.insert(std::pair<String, PID_t>(I->key, p));
-			sprintf(str, "Profiles PID: %s [%f, %f, %f]", I->key, p.P, p.I, p.D);
+			PID_t * p = self->pid.add();
+			if (!p)
+				break;
+			p->id = I->key;
+			p->P = I->value[0];
+			p->I = I->value[1];
+			p->D = I->value[2];
+			const char * model = I->value[3].as<const char*>();
+			p->model = model && strcmp(model, "model") == 0;
+			p->gain = p->model ? 0 : I->value[3].as<float>();
+			p->tau = p->model ? 0 : I->value[4].as<float>();
+			p->dead = p->model ? 0 : I->value[5].as<float>();
+			sprintf(str, "Profiles PID: %s [%f, %f, %f]", I->key, p->P, p->I, p->D);
 			Serial.println(str);
+			if (p->model)
+				S_printf("Profiles PID: %s predicts with the learned plant model", I->key);
+			else if (p->tau > 0)
+				S_printf("Profiles PID: %s predicts with K=%f tau=%f dead=%f", I->key, p->gain, p->tau, p->dead);
+			++I;
+		}
+
+		self->schedules.clear();
+		JsonObject& schedules = json["schedules"];
+		I = schedules.begin();
+		while (I != schedules.end())
+		{
+			Schedule * s = self->schedules.add();
+			if (!s)
+				break;
+			s->load(I->key, (JsonArray&)I->value, self);
 			++I;
 		}
 
@@ -97,8 +292,10 @@ bool Config::load_profiles() {
 			sprintf(str, "Profile %s: %s", I->key, I->value["name"].as<char*>());
 			Serial.println(str);
 
-			Profile p((JsonObject&)I->value);
-			self->profiles.insert(std::pair<String, Profile>(I->key, p));
+			Profile * p = self->profiles.add();
+			if (!p)
+				break;
+			p->load(I->key, (JsonObject&)I->value);
 			++I;
 		}
 		self->tuner_id = json["tuner"]["id"];
@@ -110,8 +307,8 @@ bool Config::load_profiles() {
 	});
 }
 
-bool Config::load_json(const String& name, size_t max_size, THandlerFunction_parse parser) {
-	Serial.println("Loading config " + name + "; Heap: " + String(ESP.getFreeHeap()));
+bool Config::load_json(const char * name, size_t max_size, THandlerFunction_parse parser) {
+	S_printf("Loading config %s; Heap: %u", name, ESP.getFreeHeap());
 	File configFile = SPIFFS.open(name, "r");
 	if (!configFile) {
 		Serial.println("Could not open config file");
@@ -138,20 +335,20 @@ bool Config::load_json(const String& name, size_t max_size, THandlerFunction_par
 	if (parser)
 	 	parsed = parser(json, this);
 
-	Serial.println("Loading config " + name + " DONE; Heap: " + String(ESP.getFreeHeap()));
+	S_printf("Loading config %s DONE; Heap: %u", name, ESP.getFreeHeap());
 	return parsed;
 }
 
 bool Config::setup_OTA() {
 	Serial.println("OTA setup");
 
-	OTA = new EasyOTA(hostname);
+	OTA = new EasyOTA(hostname.c_str());
 
-	std::map<String, String>::iterator I = networks.begin();
+	FixedTable<Network_t, NETWORKS_MAX>::iterator I = networks.begin();
 	Serial.println("** Config.cpp - setup_OTA iterate networks");
 	while (I != networks.end()) {
-		OTA->addAP(I->first, I->second);
-		Serial.println("Add network: " + I->first);
+		OTA->addAP(I->id.c_str(), I->password.c_str());
+		S_printf("Add network: %s", I->id.c_str());
 		I++;
 	}
 
@@ -171,13 +368,15 @@ bool Config::save_profiles(AsyncWebServerRequest *request, uint8_t * data, size_
 	return save_file(request, profilesName, data, len, index, total);
 }
 
-bool Config::save_file(AsyncWebServerRequest *request, const String& fname, uint8_t * data, size_t len, size_t index, size_t total)
+bool Config::save_file(AsyncWebServerRequest *request, const char * fname, uint8_t * data, size_t len, size_t index, size_t total)
 {
-	Serial.println("Saving config " + fname +" len/index: " + String(len) + "/" +  String(index));
+	char str[128] = "";
+	S_printf("Saving config %s len/index: %u/%u", fname, len, index);
 
 	File f = SPIFFS.open(fname, index != 0 ? "a" : "w");
   if (!f) {
-		request->send(404, "application/json", "{\"msg\": \"ERROR: couldn't " + fname + " file for writing!\"}");
+		snprintf(str, sizeof(str), "{\"msg\": \"ERROR: couldn't open %s file for writing!\"}", fname);
+		request->send(404, "application/json", str);
 		return false;
 	}
 
@@ -187,7 +386,8 @@ bool Config::save_file(AsyncWebServerRequest *request, const String& fname, uint
 
 	if (f.size() >= total)
 	{
-		request->send(200, "application/json", "{\"msg\": \"INFO: " + fname + " saved!\"}");
+		snprintf(str, sizeof(str), "{\"msg\": \"INFO: %s saved!\"}", fname);
+		request->send(200, "application/json", str);
 		Serial.println("Saving config... DONE");
 	}
 
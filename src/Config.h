@@ -6,53 +6,131 @@
 #include <FS.h>
 #include <SPIFFS.h>
 #include <XJM_EasyOTA.h>
-#include <map>
+#include "Fixed.h"
+#include "Program.h"
 #include "wificonfig.h"
 
+// heater zones besides the main one
+#define ZONES_MAX 8
+
+// Config data lives in fixed tables inside the Config object, reloading
+// overwrites them in place instead of churning the heap
+#define CONFIG_NAME 24
+#define CONFIG_TEXT 64
+#define PIDS_MAX 16
+#define PROFILES_MAX 8
+#define PROFILE_STAGES 10
+#define NETWORKS_MAX 4
+#define SCHEDULES_MAX 4
+#define SCHEDULE_POINTS 8
+
 class Config {
 public:
+	typedef FixedString<CONFIG_NAME> Name_t;
+
 	typedef struct {
+		Name_t id;
 		float P, I, D;
+		// Smith predictor model, [P, I, D, K, tau, dead]; tau 0 for none.
+		// [P, I, D, "model"] predicts with the learned plant model.
+		float gain, tau, dead;
+		bool model;
 	} PID_t;
 
+	// PID gains over temperature, interpolated between the points; a stage
+	// or mode names a schedule the same way it names a PID set
+	class Schedule {
+	public:
+		typedef struct {
+			float temperature;
+			float P, I, D;
+		} Point_t;
+
+		bool load(const char * key, JsonArray& json, Config * config);
+
+		void at(float temperature, float& P, float& I, float& D) const;
+
+		Name_t id;
+		// sorted by temperature
+		Point_t points[SCHEDULE_POINTS];
+		uint8_t count;
+	};
+
 	class Stage {
 	public:
+		Stage();
 		Stage(const char * n, const char * p, float t, float r, float s);
 
-		String name;
-		String pid;
+		Name_t name;
+		Name_t pid;
 		float target;
 		float rate;
 		float stay;
+		// per zone targets for this stage, NAN to follow the main target
+		float zones[ZONES_MAX];
 	};
-	typedef std::vector<Stage>::iterator stages_iterator;
+	typedef FixedTable<Stage, PROFILE_STAGES>::iterator stages_iterator;
 
 	class Profile {
 	public:
-		Profile(JsonObject& json);
+		bool load(const char * key, JsonObject& json);
 
 		stages_iterator begin() {return stages.begin();}
 		stages_iterator end() {return stages.end();}
 
-		std::vector<Stage> stages;
-		String name;
+		FixedTable<Stage, PROFILE_STAGES> stages;
+		Name_t id;
+		FixedString<CONFIG_TEXT> name;
+		// let the learned plant model adjust the gains
+		bool retune;
+		// the stages compiled, what a reflow run actually executes
+		Program program;
+
+	private:
+		bool compile(const char * key, uint8_t index, JsonObject& stage, uint16_t * stage_pc, uint8_t& counters);
 	};
 
-	typedef std::map<String, Profile>::iterator profiles_iterator;
+	typedef FixedTable<Profile, PROFILES_MAX>::iterator profiles_iterator;
+
+	typedef struct {
+		Name_t name;
+		uint8_t cs;
+		uint8_t relay;
+	} Zone_t;
+
+	// a probe on the board and the outer loop that controls it
+	typedef struct {
+		uint8_t cs;			// MAX31855 chip select, 0 for none
+		uint8_t address;	// MLX90614 I2C address, 0 for none
+		float P, I, D;
+		uint16_t interval;	// ms
+		float margin;		// C the plate may be set off the board target
+	} Board_t;
+
+	typedef struct {
+		FixedString<33> id;
+		FixedString<CONFIG_TEXT> password;
+	} Network_t;
 
 public:
-	String cfgName;
-	String profilesName;
-	std::map<String, String> networks;
+	Name_t cfgName;
+	Name_t profilesName;
+	FixedTable<Network_t, NETWORKS_MAX> networks;
+
+	FixedTable<PID_t, PIDS_MAX> pid;
+	FixedTable<Schedule, SCHEDULES_MAX> schedules;
+	FixedTable<Profile, PROFILES_MAX> profiles;
+
+	Zone_t zones[ZONES_MAX];
+	uint8_t zone_count;
 
-	std::map<String, PID_t> pid;
-	std::map<String, Profile> profiles;
+	Board_t board;
 
 public:
-	String hostname;
-	String user;
-	String password;
-	String otaPassword;
+	FixedString<CONFIG_TEXT> hostname;
+	FixedString<CONFIG_TEXT> user;
+	FixedString<CONFIG_TEXT> password;
+	FixedString<CONFIG_TEXT> otaPassword;
 	float measureInterval;
 	float reportInterval;
 	int tuner_id;
@@ -65,20 +143,20 @@ public:
 	typedef std::function<bool(JsonObject& json, Config * self)> THandlerFunction_parse;
 
 public:
-	Config(const String& cfg, const String& profiles);
+	Config(const char * cfg, const char * profiles);
 
 	bool load_config();
 
 	bool load_profiles();
 
-	bool load_json(const String& name, size_t max_size, THandlerFunction_parse parser);
+	bool load_json(const char * name, size_t max_size, THandlerFunction_parse parser);
 
 	bool setup_OTA();
 
 	bool save_config(AsyncWebServerRequest *request, uint8_t * data, size_t len, size_t index, size_t total);
 	bool save_profiles(AsyncWebServerRequest *request, uint8_t * data, size_t len, size_t index, size_t total);
 
-	bool save_file(AsyncWebServerRequest *request, const String& fname, uint8_t * data, size_t len, size_t index, size_t total);
+	bool save_file(AsyncWebServerRequest *request, const char * fname, uint8_t * data, size_t len, size_t index, size_t total);
 };
 
 void S_printf(const char * format, ...);
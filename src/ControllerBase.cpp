@@ -1,22 +1,34 @@
 #include "ControllerBase.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 ControllerBase::ControllerBase(Config& cfg) :
 	config(cfg),
-	pidTemperature(&_temperature, &_target_control, &_target, .5/DEFAULT_TEMP_RISE_AFTER_OFF, 5.0/DEFAULT_TEMP_RISE_AFTER_OFF, 4/DEFAULT_TEMP_RISE_AFTER_OFF, DIRECT),
+	_models(MODEL_FILE),
+	_ilc_tables(ILC_FILE),
+	_duty_tables(DUTY_MAP_FILE),
+	_feedforward(0),
+	_last_target(NAN),
+	_plate_target(DEFAULT_TARGET),
+	_smith_model(false),
+	pidTemperature(&_pid_input, &_pid_control, &_plate_target, .5/DEFAULT_TEMP_RISE_AFTER_OFF, 5.0/DEFAULT_TEMP_RISE_AFTER_OFF, 4/DEFAULT_TEMP_RISE_AFTER_OFF, DIRECT),
 	aTune(&_temperature, &_target_control, &_target, &_now, DIRECT),
-	thermocouple(thermoCLK, thermoCS, thermoDO)
+	thermocouple(thermoCLK, thermoCS, thermoDO),
+	_zones(cfg)
 {
-	_readings.reserve(15 * 60);
-
 	_calP = .5/DEFAULT_TEMP_RISE_AFTER_OFF;
 	_calD =  5.0/DEFAULT_TEMP_RISE_AFTER_OFF;
 	_calI = 4/DEFAULT_TEMP_RISE_AFTER_OFF;
 
-	pidTemperature.SetSampleTime(config.measureInterval * 1000);
+	// the sample interval varies, Compute() scales to the time that passed
+	pidTemperature.SetSampleTime(SAMPLE_MIN * 1000);
   	pidTemperature.SetMode(AUTOMATIC);
 	pidTemperature.SetOutputLimits(0, 1);
 	thermocouple.begin();
-	
+	_zones.begin(thermoCLK, thermoDO);
+	_board.begin(thermoCLK, thermoDO, cfg.board.cs, cfg.board.address, SDA, SCL);
+	_cascade.begin(cfg.board.P, cfg.board.I, cfg.board.D, cfg.board.interval, cfg.board.margin);
+
 	pinMode(RELAY, OUTPUT);
 	pinMode(LED_RED, OUTPUT);
 	pinMode(LED_BLUE, OUTPUT);
@@ -26,19 +38,6 @@ ControllerBase::ControllerBase(Config& cfg) :
 	digitalWrite(LED_RED, LOW);
 	digitalWrite(LED_GREEN, LOW);
 	digitalWrite(LED_BLUE, LOW);
-	digitalWrite(LED_RED, HIGH);
-	delay(300);
-	digitalWrite(LED_GREEN, HIGH);
-	digitalWrite(LED_RED, LOW);
-	digitalWrite(LED_BLUE, LOW);
-	delay(300);
-	digitalWrite(LED_BLUE, HIGH);
-	digitalWrite(LED_RED, LOW);
-	digitalWrite(LED_BLUE, LOW);
-	delay(300);
-	digitalWrite(LED_RED, LOW);
-	digitalWrite(LED_GREEN, LOW);
-	digitalWrite(LED_BLUE, LOW);
 
 	_mode = _last_mode = INIT;
 	_temperature = 0;
@@ -46,11 +45,23 @@ ControllerBase::ControllerBase(Config& cfg) :
 	_onMessage = NULL;
 	_onMode = NULL;
 	_onReadingsReport = NULL;
+	_onCommand = NULL;
+	_schedule = NULL;
+	_retune = false;
+	_profiles_pending = false;
 	_locked = false;
 	_watchdog = 0;
+	_sampler.begin(config.measureInterval);
+	_sample_interval = _sampler.interval();
+	_sample_dt = _sample_interval;
+	_window_start = 0;
+	_window_control = 0;
 	_last_heater_on = 0;
+	_start_time = 0;
 
 	_heater = _last_heater = false;
+	_ready = false;
+	_self_test = false;
 
 	//pinMode(BUZZER_A, OUTPUT);
 	//pinMode(BUZZER_B, OUTPUT);
@@ -58,20 +69,61 @@ ControllerBase::ControllerBase(Config& cfg) :
 	//tone(BUZZER_A, 440, 100);
 
 	setPID("default");
+	publish(0);
+}
 
-	thermocouple.read();
-	_temperature = thermocouple.getTemperature();
+void ControllerBase::led_test()
+{
+	_self_test = true;
+	digitalWrite(LED_RED, HIGH);
+	delay(300);
+	digitalWrite(LED_GREEN, HIGH);
+	digitalWrite(LED_RED, LOW);
+	digitalWrite(LED_BLUE, LOW);
+	delay(300);
+	digitalWrite(LED_BLUE, HIGH);
+	digitalWrite(LED_RED, LOW);
+	digitalWrite(LED_BLUE, LOW);
+	delay(300);
+	digitalWrite(LED_RED, LOW);
+	digitalWrite(LED_GREEN, LOW);
+	digitalWrite(LED_BLUE, LOW);
+	_self_test = false;
+}
+
+void ControllerBase::warmup()
+{
+	// the MAX31855 needs a conversion cycle after power up before its
+	// first reading is valid
+	unsigned long start = millis();
+	do {
+		_temperature = read_thermocouple();
+		if (!isnan(_temperature) && _temperature != 0)
+			break;
+		delay(20);
+	} while (millis() - start < THERMOCOUPLE_WARMUP);
 
 	S_printf("Current temperature: %f\n", _temperature);
-	_readings.push_back(temperature_to_log(_temperature));
+	_readings.start(temperature_to_log(_temperature));
+	_ready = true;
 }
 
 
 void ControllerBase::loop(unsigned long now)
 {
-	if (_last_mode == _mode && _mode >= ON)
+	// requests from the network task take effect here and nowhere else, so
+	// a tick never sees them halfway. Until warmup() is done they wait, it
+	// has the thermocouple to itself
+	if (_ready)
+		handle_commands(now);
+	if (_profiles_pending && _mode < ON)
+		reload_profiles();
+
+	// keep on measuring while a fault is latched, so the cause can be followed
+	if (_last_mode == _mode && (_mode >= ON || _faults.active()))
 	{
-		if (now - last_m > config.measureInterval) {
+		if (now - last_m > _sample_interval) {
+			MetricsTimer t(metrics.measure);
 			handle_measure(now);
 		}
 	}
@@ -79,6 +131,8 @@ void ControllerBase::loop(unsigned long now)
 	switch (_mode)
 	{
 		case INIT:
+			if (!_ready)
+				break;
 			callMessage("%s Initialized and ready", name());
 			mode(OFF);
 			break;
@@ -109,32 +163,192 @@ void ControllerBase::loop(unsigned long now)
 			}
 	}
 
+	// the control is final now, feedforward, ILC and coast included
+	_smith.apply(_mode == TARGET_PID || _mode == REFLOW ? _window_control : _mode == ON ? 1 : 0);
+
+	if (_mode == ON)
+		_zones.drive(Zones::ALL_ON, 0, 0);
+	else if (_mode == TARGET_PID || _mode == REFLOW)
+		_zones.drive(Zones::CONTROL, window_phase(now), config.measureInterval);
+	else
+		_zones.drive(Zones::ALL_OFF, 0, 0);
+
 	handle_mode(now);
 
 	handle_safety(now);
 
+	_model.heater(now, _heater);
 	digitalWrite(RELAY, _heater);
-	digitalWrite(LED_RED, _heater);
+	_zones.write();
+	if (!_self_test)
+		digitalWrite(LED_RED, _heater);
 
+	if (_heater != _last_heater)
+		trace.counter("relay", _heater);
 	if (_onHeater && _heater != _last_heater)
 		_onHeater(_heater);
 	_last_heater = _heater;
+
+	publish(now);
+}
+
+void ControllerBase::publish(unsigned long now) {
+	State_t s;
+	s.now = now;
+	s.mode = _mode;
+	s.heater = _heater;
+	s.ready = _ready;
+	s.temperature = _temperature;
+	s.target = _target;
+	s.avg_rate = _avg_rate;
+	s.interval = _sample_interval;
+	s.start_time = _start_time;
+	s.fault = _faults.code();
+	s.calP = _calP;
+	s.calI = _calI;
+	s.calD = _calD;
+	s.profile = profile();
+	s.stage = stage();
+	s.model = _model.params();
+	s.board = _board.present() ? _cascade.temperature() : NAN;
+	_state.write(s);
+}
+
+ControllerBase::MODE_t ControllerBase::mode(MODE_t m) {
+	MODE_t last = _mode;
+	bool heating = m == ON || m == TARGET_PID || m == CALIBRATE || m == REFLOW;
+	if (heating && _faults.active()) {
+		callMessage("ERROR: %s fault is latched, clear it first!", Faults::translate(_faults.code()));
+		return last;
+	}
+	_mode = m;
+	// an abort inside handle_reflow() returns before handle_pid(), the
+	// relay must not carry this tick's state over
+	if (!heating)
+		_heater = false;
+	return last;
+}
+
+void ControllerBase::reload_profiles() {
+	_profiles_pending = false;
+	// the tables are rebuilt in place, nothing may point into them
+	_schedule = NULL;
+	config.load_profiles();
+	callMessage("INFO: Profiles reloaded");
+	if (!_profile.length())
+		return;
+	char name[CONFIG_TEXT];
+	snprintf(name, sizeof(name), "%s", _profile.c_str());
+	profile(name);
+}
+
+void ControllerBase::reset_ilc(const char * name) {
+	const char * profile = name && *name ? name : _profile.c_str();
+	_ilc_tables.remove(profile);
+	if (_profile == profile)
+		_ilc.clear();
+	callMessage("INFO: Feedforward of '%s' reset", profile);
+}
+
+bool ControllerBase::acknowledge_fault() {
+	return _faults.acknowledge();
+}
+
+bool ControllerBase::clear_fault(unsigned long now) {
+	if (!_faults.active())
+		return false;
+	if (_faults.holdoff(now)) {
+		callMessage("WARNING: Fault hold-off, try again in %i seconds", (int)((FAULT_HOLDOFF - (now - _faults.history().raised)) / 1000 + 1));
+		return false;
+	}
+	if (isnan(_temperature) || _temperature > MAX_TEMPERATURE) {
+		callMessage("WARNING: Fault cause is still present (T=%.2f)", (float)_temperature);
+		return false;
+	}
+	Faults::FAULT_t code = _faults.code();
+	_faults.clear(now);
+	callMessage("INFO: Fault cleared: %s", Faults::translate(code));
+	return true;
+}
+
+bool ControllerBase::post(COMMAND_t command, float value, const char * name) {
+	Command_t c;
+	c.command = command;
+	c.value = value;
+	c.name = name;
+	return _mailbox.push(c);
+}
+
+void ControllerBase::handle_commands(unsigned long now) {
+	TRACE_SCOPE("handle_commands");
+	Command_t c;
+	while (_mailbox.pop(c)) {
+		switch (c.command) {
+			case CMD_MODE: mode((MODE_t)(int)c.value); break;
+			case CMD_PROFILE: profile(c.name); break;
+			case CMD_TARGET: target(constrain(c.value, 0, MAX_TEMPERATURE)); break;
+			case CMD_FAULT_ACK: acknowledge_fault(); break;
+			case CMD_FAULT_CLEAR: clear_fault(now); break;
+			case CMD_REPORT: measure_temperature(now); break;
+			case CMD_ILC_RESET: reset_ilc(c.name); break;
+			case CMD_PROFILES:
+				_profiles_pending = true;
+				if (_mode >= ON)
+					callMessage("INFO: Profiles saved, they are loaded once the oven is off");
+				break;
+		}
+		if (_onCommand)
+			_onCommand(c);
+	}
 }
 
 PID& ControllerBase::setPID(float P, float I, float D) {
-	resetPID();
-	pidTemperature.SetTunings(P, I, D);
-	return pidTemperature;
+	_schedule = NULL;
+	_gains[0] = P;
+	_gains[1] = I;
+	_gains[2] = D;
+	return tune(P, I, D);
 }
 
-PID& ControllerBase::setPID(const String& name) {
-	if (config.pid.find(name) == config.pid.end()) {
-		callMessage("WARNING: No PID named '%s' found!!", name.c_str());
+PID& ControllerBase::setPID(const char * name) {
+	Config::PID_t * pid = config.pid.find(name);
+	if (pid != config.pid.end()) {
+		callMessage("INFO: Setting PID to '%s'.", name);
+		setPID(pid->P, pid->I, pid->D);
+		predict(pid);
 		return pidTemperature;
-	} else {
-		callMessage("INFO: Setting PID to '%s'.", name.c_str());
-		return setPID(config.pid[name].P, config.pid[name].I, config.pid[name].D);
 	}
+
+	Config::Schedule * schedule = config.schedules.find(name);
+	if (schedule != config.schedules.end() && schedule->count > 0) {
+		callMessage("INFO: Setting PID to schedule '%s'.", name);
+		float P, I, D;
+		schedule->at(_temperature, P, I, D);
+		tune(P, I, D);
+		_schedule = schedule;
+		predict(NULL);
+		return pidTemperature;
+	}
+
+	callMessage("WARNING: No PID named '%s' found!!", name);
+	return pidTemperature;
+}
+
+void ControllerBase::predict(const Config::PID_t * pid) {
+	_smith_model = pid && pid->model;
+	if (_smith_model && _model.valid()) {
+		const Model::Params_t& m = _model.params();
+		_smith.begin(m.gain, m.tau, m.dead, _temperature);
+	} else if (pid && pid->tau > 0)
+		_smith.begin(pid->gain, pid->tau, pid->dead, _temperature);
+	else
+		_smith.begin(0, 0, 0, _temperature);
+}
+
+PID& ControllerBase::tune(float P, float I, float D) {
+	pidTemperature.Retune(P, I, D);
+	_zones.tune(P, I, D);
+	return pidTemperature;
 }
 
 void ControllerBase::resetPID() {
@@ -143,7 +357,18 @@ void ControllerBase::resetPID() {
 
 String ControllerBase::calibrationString() {
 	char str[64] = "";
-	sprintf(str, "[%f, %f, %f]", _calP, _calI, _calD);
+	State_t s;
+	state(s);
+	sprintf(str, "[%f, %f, %f]", s.calP, s.calI, s.calD);
+	return str;
+}
+
+String ControllerBase::modelString() {
+	char str[128] = "";
+	State_t s;
+	state(s);
+	sprintf(str, "{\"gain\": %f, \"tau\": %f, \"dead\": %f, \"fits\": %u, \"valid\": %s}",
+		s.model.gain, s.model.tau, s.model.dead, s.model.fits, Model::valid(s.model) ? "true" : "false");
 	return str;
 }
 
@@ -173,13 +398,19 @@ float ControllerBase::log_to_temperature(ControllerBase::Temperature_t t) {
 }
 
 float ControllerBase::measure_temperature(unsigned long now) {
-	if (now - last_m > config.measureInterval * 1.1) {
+	if (now - last_m > _sample_interval * 1.1) {
 		last_m = now;
-		thermocouple.read();
-		return temperature(thermocouple.getTemperature());
+		return temperature(read_thermocouple());
 	} else
 		return temperature();
 }
+float ControllerBase::read_thermocouple() {
+	MetricsTimer t(metrics.thermocouple);
+	TRACE_SCOPE("thermocouple");
+	thermocouple.read();
+	return thermocouple.getTemperature();
+}
+
 unsigned long ControllerBase::elapsed(unsigned long now) {
 	return now - _start_time;
 }
@@ -202,18 +433,28 @@ void ControllerBase::reportReadings(unsigned long now)
 }
 
 void ControllerBase::handle_mode(unsigned long now) {
+	TRACE_SCOPE("handle_mode");
 	if (_last_mode <= OFF && _mode > OFF)
 	{
 		_start_time = now;
-		thermocouple.read();
-		_temperature = thermocouple.getTemperature();
+		_temperature = read_thermocouple();
+		_smith.reset(now, _temperature);
+		_pid_input = _temperature;
 		pidTemperature.Reset();
-		_readings.clear();
-		_readings.push_back(temperature_to_log(_temperature));
+		_zones.reset();
+		_zones.measure(now);
+		_zones.log();
+		_readings.start(temperature_to_log(_temperature));
 		reportReadings(now - _start_time);
 		last_m = now;
 		last_log_m = now;
+		// the first window starts with the first computed duty
+		_window_start = now - config.measureInterval;
 		_avg_rate = 0;
+		_sample_interval = _sampler.fixed();
+		_sample_dt = _sample_interval;
+		_last_target = NAN;
+		_cascade.reset(now);
 
 		if (_mode == CALIBRATE) {
 			_target_control = config.tuner_init_output; 		// initial output
@@ -227,18 +468,58 @@ void ControllerBase::handle_mode(unsigned long now) {
 
 			_now = now;
 			aTune.Runtime();				// initialize autotuner here, as later we give it actual readings
-		} else if (_mode == TARGET_PID) {
+		}
+		if (_mode == TARGET_PID || _mode == REFLOW) {
+			DutyMap::Table_t table;
+			_duty.begin(_duty_tables.load(_profile.c_str(), table) ? &table : NULL);
+		}
+		if (_mode == TARGET_PID) {
 			setPID("default");
 			pidTemperature.Reset();
+		} else if (_mode == REFLOW) {
+			Model::Params_t saved;
+			bool seeded = _models.load(_profile.c_str(), saved);
+			_model.begin(now, seeded ? &saved : NULL);
+			if (seeded)
+				callMessage("INFO: Plant model from the last run: K=%.1f*C tau=%.1fs dead=%.1fs", saved.gain, saved.tau, saved.dead);
+			// the first stage's PID set was chosen before there was a model
+			if (_smith_model && _model.valid()) {
+				const Model::Params_t& m = _model.params();
+				_smith.begin(m.gain, m.tau, m.dead, _temperature);
+			}
+
+			_ilc.clear();
+			_ilc_tables.load(_profile.c_str(), _ilc.table());
+			_ilc.begin(NULL);
+			if (_ilc.table().runs)
+				callMessage("INFO: Feedforward learned over %u runs", _ilc.table().runs);
 		}
 
 	} else if (_mode <= OFF && _last_mode > OFF)
 	{
-		thermocouple.read();
-		_temperature = thermocouple.getTemperature();
-		_readings.push_back(temperature_to_log(_temperature));
-		if (_last_mode == REFLOW || _last_mode == REFLOW_COOL)
+		_temperature = read_thermocouple();
+		_readings.push(temperature_to_log(_temperature));
+		if (_last_mode == REFLOW || _last_mode == REFLOW_COOL) {
 			setPID("default");
+			// the heater is off by now, the short flash writes can't hurt
+			if (_mode == OFF && _model.valid()) {
+				const Model::Params_t& m = _model.params();
+				_models.save(_profile.c_str(), m);
+				callMessage("INFO: Plant model saved: K=%.1f*C tau=%.1fs dead=%.1fs (%u fits)", m.gain, m.tau, m.dead, m.fits);
+			}
+			// only a profile that ran to the end teaches the feedforward
+			if (_mode == OFF && _last_mode == REFLOW_COOL) {
+				float error = _ilc.learn();
+				_ilc_tables.save(_profile.c_str(), _ilc.table());
+				callMessage("INFO: Feedforward updated after run %u, mean tracking error %.2f*C", _ilc.table().runs, error);
+			}
+		}
+		if (_mode == OFF && _duty.learned() && (_last_mode == TARGET_PID || _last_mode == REFLOW || _last_mode == REFLOW_COOL)) {
+			DutyMap::Table_t table;
+			_duty.pack(table);
+			_duty_tables.save(_profile.c_str(), table);
+			callMessage("INFO: Holding duties saved, %u samples learned", _duty.learned());
+		}
 		reportReadings(now - _start_time);
 	}
 	if (_onMode && _last_mode != _mode) {
@@ -248,29 +529,107 @@ void ControllerBase::handle_mode(unsigned long now) {
 }
 
 void ControllerBase::handle_measure(unsigned long now) {
+	TRACE_SCOPE("handle_measure");
 	double last_temperature = _temperature;
-	thermocouple.read();
-	_temperature = thermocouple.getTemperature();
-	double rate = 1000.0 * (_temperature - last_temperature) / (double)config.measureInterval;
-	_avg_rate = _avg_rate * .9 + rate * .1;
-
+	_temperature = read_thermocouple();
+	_zones.measure(now);
+	if (_board.present() && _cascade.due(now))
+		_cascade.measure(now, _board.read());
+	// rate and average over the time that actually passed, the weight keeps
+	// the average's time constant whatever the interval
+	_sample_dt = max(now - last_m, 1UL);
+	double rate = 1000.0 * (_temperature - last_temperature) / (double)_sample_dt;
+	if (_mode == REFLOW || _mode == REFLOW_COOL)
+		_model.measure(now, _temperature);
+	double alpha = (double)_sample_dt / (_sample_dt + RATE_AVERAGE * config.measureInterval);
+	_avg_rate += (rate - _avg_rate) * alpha;
+
+	long late = (long)_sample_dt - (long)_sample_interval;
+	metrics.jitter.observe(abs(late) * 1000);
 	last_m = now;
+
+	// the auto tuner relies on a fixed sample time
+	_sample_interval = _mode == CALIBRATE ? _sampler.fixed() : _sampler.next(_avg_rate);
+	metrics.sample_interval = _sample_interval;
 	if (_mode != CALIBRATE) {
+		if (_schedule || _retune) {
+			float P = _gains[0], I = _gains[1], D = _gains[2];
+			if (_schedule)
+				_schedule->at(_temperature, P, I, D);
+			if (_retune && _mode == REFLOW)
+				_model.retune(P, I, D);
+			tune(P, I, D);
+		}
+		// the outer loop moves the plate's setpoint at its own pace, everything
+		// below is about the plate
+		bool heating = _mode == TARGET_PID || _mode == REFLOW;
+		_plate_target = heating && cascading() ? _cascade.compute(now, _target, _temperature, _target_control) : _target;
+
+		// a steady hold teaches the duty for its temperature
+		bool holding = _plate_target == _last_target && fabs(_temperature - _plate_target) < DUTY_MAP_BAND && fabs(_avg_rate) < DUTY_MAP_RATE;
+		if (heating && holding)
+			_duty.learn(_plate_target, _target_control);
+		_last_target = _plate_target;
+
+		// the PID works around the learned duty, its limits move with it so
+		// the integral can't wind up beyond what the heater can do
+		double ff = heating ? _duty.at(_plate_target) : NAN;
+		ff = isnan(ff) ? 0 : ff;
+		if (ff != _feedforward) {
+			_feedforward = ff;
+			pidTemperature.SetOutputLimits(-ff, 1 - ff);
+		}
+		// with a model of the dead time, the PID sees where the temperature
+		// is already headed
+		_smith.advance(now);
+		_pid_input = _temperature + _smith.correction();
 		pidTemperature.Compute(now * 1000);
-		_target_control = max(_target_control, 0.0);
+		_target_control = constrain(_pid_control + _feedforward, 0.0, 1.0);
+		if (_mode == REFLOW) {
+			unsigned long elapsed = now - _start_time;
+			_target_control = constrain(_target_control + _ilc.at(elapsed), 0.0, 1.0);
+			_ilc.track(elapsed, _plate_target - _temperature, _target_control);
+		}
+		_zones.compute(now, _target);
 	}
 
-	callMessage("DEBUG: PID: <code>e=%f     i=%f     d=%f       Tt=%f       T=%f     C=%f     rate=%f</code>",
-			pidTemperature._e, pidTemperature._i, pidTemperature._d, (float)_target, (float)_temperature, (float)_target_control, (float)_avg_rate);
+	callMessage("DEBUG: PID: <code>e=%f     i=%f     d=%f       Tt=%f       T=%f     C=%f     ff=%f     rate=%f</code>",
+			pidTemperature._e, pidTemperature._i, pidTemperature._d, (float)_target, (float)_temperature, (float)_target_control, (float)_feedforward, (float)_avg_rate);
 
 	if (now - last_log_m > config.reportInterval) {
-		_readings.push_back(temperature_to_log(_temperature));
+		_readings.push(temperature_to_log(_temperature));
+		_zones.log();
 		last_log_m = now;
 		reportReadings(now - _start_time);
 	}
 }
 
+void ControllerBase::trip(Faults::FAULT_t code, unsigned long now) {
+	mode(ERROR_OFF);
+	_heater = false;
+	_zones.drive(Zones::ALL_OFF, 0, 0);
+	_faults.raise(code, now, _temperature);
+}
+
 void ControllerBase::handle_safety(unsigned long now) {
+	TRACE_SCOPE("handle_safety");
+	if (_faults.active()) {
+		_heater = false;
+		_zones.drive(Zones::ALL_OFF, 0, 0);
+		// a watchdog fault lets go by itself once the client is back
+		if (Faults::self_clearing(_faults.code()) && (long)(now - _watchdog) < WATCHDOG_TIMEOUT && _faults.clear(now))
+			callMessage("INFO: Fault cleared: %s", Faults::translate(Faults::WATCHDOG));
+		return;
+	}
+
+	Faults::FAULT_t fault;
+	int zone = _zones.check(now, fault);
+	if (zone >= 0) {
+		trip(fault, now);
+		callMessage("ERROR: Zone '%s': %s", _zones.name(zone), Faults::translate(fault));
+		return;
+	}
+
 	if (!_heater) {
 		_last_heater_on = now;
 		return;
@@ -280,60 +639,62 @@ void ControllerBase::handle_safety(unsigned long now) {
 
 	if (now - _last_heater_on > MAX_ON_TIME * factor && _temperature > SAFE_TEMPERATURE)
 	{
-		mode(ERROR_OFF);
-		_heater = false;
+		trip(Faults::HEATER_TIME, now);
 		callMessage("ERROR: Heater time limit exceeded (%i seconds)", (int)(MAX_ON_TIME / 1000));
 		return;
 	}
 
 	if (_temperature > MAX_TEMPERATURE)
 	{
-		mode(ERROR_OFF);
-		_heater = false;
+		trip(Faults::OVER_TEMPERATURE, now);
 		callMessage("ERROR: Temperature limit exceeded");
 		return;
 	}
 
 	if (isnan(_temperature)) {
-		mode(ERROR_OFF);
-		_heater = false;
+		trip(Faults::PROBE, now);
 		callMessage("ERROR: Error reading temperature. Check the probe!");
 		return;
 	}
 
-	long _calc = now - _watchdog;
-	// We should swap now and _watchdog? As loggin showed a negative value?
-	//if (now - _watchdog > WATCHDOG_TIMEOUT) {
-	if (_calc > WATCHDOG_TIMEOUT) {
-		mode(ERROR_OFF);
-		_heater = false;
-		Serial.print("** debug - ControllerBase - handle_safety - _calc : ");
-		Serial.println(_calc);
-		Serial.print("** debug - ControllerBase - handle_safety - now             : ");
-		Serial.println(now);
-		Serial.print("** debug - ControllerBase - handle_safety - _wachdog        : ");
-		Serial.println(_watchdog);
-		Serial.print("** debug - ControllerBase - handle_safety - WATCHDOG_TIMEOUT: ");
-		Serial.println(WATCHDOG_TIMEOUT);
-		callMessage("ERROR: Watchdog timeout. Check connectivity!");
-		delay(10000); 		// Wait 10 seconds
+	// _watchdog is set from the network task and can be ahead of now
+	long since = now - _watchdog;
+	if (since > WATCHDOG_TIMEOUT) {
+		trip(Faults::WATCHDOG, now);
+		callMessage("ERROR: Watchdog timeout (%li ms). Check connectivity!", since);
 		return;
 	}
 
-	if (now - _start_time > MIN_TEMP_RISE_TIME && _temperature - _readings[0] < MIN_TEMP_RISE && _temperature < SAFE_TEMPERATURE) {
-		mode(ERROR_OFF);
-		_heater = false;
+	if (now - _start_time > MIN_TEMP_RISE_TIME && _temperature - _readings.first() < MIN_TEMP_RISE && _temperature < SAFE_TEMPERATURE) {
+		trip(Faults::NO_RISE, now);
 		callMessage("ERROR: Temperature did not rise for %i seconds!",  (int)(MIN_TEMP_RISE_TIME / 1000));
 		return;
 	}
 }
 
 void ControllerBase::handle_pid(unsigned long now) {
-	_heater = now - last_m < config.measureInterval * _target_control && _target_control > CONTROL_HYSTERISIS ||
-					now - last_m >= config.measureInterval * _target_control && _target_control > 1.0-CONTROL_HYSTERISIS;
+	MetricsTimer t(metrics.pid);
+	TRACE_SCOPE("handle_pid");
+	unsigned long phase = window_phase(now);
+	_heater = phase < config.measureInterval * _window_control && _window_control > CONTROL_HYSTERISIS ||
+					phase >= config.measureInterval * _window_control && _window_control > 1.0-CONTROL_HYSTERISIS;
+}
+
+// The heater is time proportioned over a window of config.measureInterval,
+// independent of when the temperature is sampled. The PID computes more
+// often than that, its duty is taken once per window so the relay switches
+// at most twice in one.
+unsigned long ControllerBase::window_phase(unsigned long now) {
+	if (now - _window_start >= config.measureInterval) {
+		_window_start = now;
+		_window_control = _target_control;
+		_zones.latch();
+	}
+	return now - _window_start;
 }
 
 void ControllerBase::handle_calibration(unsigned long now) {
+	TRACE_SCOPE("handle_calibration");
 	_now = now;
 	if (aTune.Runtime()) {
 			_heater = false;
@@ -5,6 +5,19 @@
 #include <SPI.h>
 #include <max31855.h>
 #include "Config.h"
+#include "Faults.h"
+#include "Zones.h"
+#include "Mailbox.h"
+#include "Readings.h"
+#include "Seqlock.h"
+#include "Sampler.h"
+#include "Model.h"
+#include "Ilc.h"
+#include "DutyMap.h"
+#include "BoardProbe.h"
+#include "Cascade.h"
+#include "Smith.h"
+#include "ProfileStore.h"
 #include <PID_AutoTune_v0.h>  // https://github.com/t0mpr1c3/Arduino-PID-AutoTune-Library
 
 #define thermoDO 12 // D7
@@ -31,6 +44,10 @@
 #define CAL_HEATUP_TEMPERATURE 90
 #define DEFAULT_CAL_ITERATIONS 3
 #define WATCHDOG_TIMEOUT 30000
+#define THERMOCOUPLE_WARMUP 500
+#define MAILBOX_SIZE 16
+// time constant of the average rate, in multiples of config.measureInterval
+#define RATE_AVERAGE 9
 
 #define CB_GETTER(T, name) virtual T name() { return _##name; }
 #define CB_SETTER(T, name) virtual T name(T name) { T pa##name = _##name; _##name = name; return pa##name; }
@@ -42,7 +59,7 @@
 class ControllerBase
 {
 public:
-	typedef float Temperature_t;
+	typedef Readings::Temperature_t Temperature_t;
 	typedef enum {
 		UNKNOWN = -100,
 		INIT = -2,
@@ -56,18 +73,60 @@ public:
 		REFLOW_COOL = 6,
 	} MODE_t;
 
+	// requests from other tasks, applied at the start of a tick
+	typedef enum {
+		CMD_MODE,
+		CMD_PROFILE,
+		CMD_TARGET,
+		CMD_FAULT_ACK,
+		CMD_FAULT_CLEAR,
+		CMD_REPORT,
+		CMD_ILC_RESET,
+		CMD_PROFILES,	// profiles.json was replaced
+	} COMMAND_t;
+
+	typedef struct {
+		COMMAND_t command;
+		float value;
+		Config::Name_t name;
+	} Command_t;
+
+	// what other tasks get to see of the controller, published every tick
+	typedef struct {
+		unsigned long now;
+		MODE_t mode;
+		bool heater;
+		bool ready;
+		float temperature;
+		float target;
+		float avg_rate;
+		unsigned long interval;
+		unsigned long start_time;
+		Faults::FAULT_t fault;
+		float calP, calI, calD;
+		FixedString<CONFIG_TEXT> profile;
+		Config::Name_t stage;
+		Model::Params_t model;
+		float board;			// NAN without a board probe
+	} State_t;
+
 	typedef std::function<void(const char * message)> THandlerFunction_Message;
 	typedef std::function<void(MODE_t last, MODE_t current)> THandlerFunction_Mode;
 	typedef std::function<void(const char * stage, float target)> THandlerFunction_Stage;
 	typedef std::function<void(bool heater)> THandlerFunction_Heater;
-	typedef std::function<void(const std::vector<Temperature_t>& readings, unsigned long now)> THandlerFunction_ReadingsReport;
+	typedef std::function<void(const Readings& readings, unsigned long now)> THandlerFunction_ReadingsReport;
+	typedef std::function<void(const Command_t& command)> THandlerFunction_Command;
 
 private:
-	std::vector<Temperature_t> _readings;
+	Readings _readings;
 	double _temperature;
 	double _target;
 	double _CALIBRATE_max_temperature;
 	double _target_control;
+	// the PID's share of _target_control, feedforward comes on top
+	double _pid_control;
+	// what the PID sees: the temperature, plus the Smith prediction
+	double _pid_input;
 	double _avg_rate;
 	unsigned long _last_heater_on;
 
@@ -75,7 +134,36 @@ private:
 
 	double _calP, _calD, _calI;
 
-	unsigned long _watchdog;
+	// written by the network task, a single word store
+	volatile unsigned long _watchdog;
+
+	Mailbox<Command_t, MAILBOX_SIZE> _mailbox;
+
+	// gain schedule in use, NULL for the fixed gains
+	const Config::Schedule * _schedule;
+	float _gains[3];
+
+	// learned during reflow runs, saved per profile
+	Model _model;
+	ProfileStore<Model::Params_t> _models;
+	Ilc _ilc;
+	ProfileStore<Ilc::Table_t> _ilc_tables;
+	// learned while holding a target, saved per profile
+	DutyMap _duty;
+	ProfileStore<DutyMap::Table_t> _duty_tables;
+	double _feedforward;
+	double _last_target;
+
+	// with a board probe, _target is the board's and the outer loop sets
+	// the plate's; without, both are the same
+	BoardProbe _board;
+	Cascade _cascade;
+	double _plate_target;
+
+	// dead time compensation of the PID set in use
+	Smith _smith;
+	bool _smith_model;
+	void predict(const Config::PID_t * pid);
 
 	PID pidTemperature;
 	PID_ATune aTune;
@@ -85,30 +173,49 @@ protected:
 
 public:
 	ControllerBase(Config& cfg);
+	// main.cpp deletes replaced controllers through this class
+	virtual ~ControllerBase() {}
 
 	virtual const char * name() = 0;
 
 	virtual void loop(unsigned long now);
 
+	// LED self test, blocking; run it from a background task
+	void led_test();
+
+	// wait for the first valid thermocouple conversion; the controller
+	// stays in INIT until this is done
+	void warmup();
+
 	CB_GETTER(double, target)
 	CB_SETTER(double, target)
 
 	CB_GETTER(double, temperature)
 
-	CB_GETTER(std::vector<Temperature_t>&, readings)
+	CB_GETTER(Readings&, readings)
+
+	// oldest and newest reading kept; numbers keep increasing across runs
+	unsigned long first_seq() { return _readings.first_seq(); }
+	unsigned long last_seq() { return _readings.last_seq(); }
+
+	// a consistent copy of the controller state as of the last tick, safe
+	// to take from any task
+	void state(State_t& s) { _state.read(s); }
 
 	CB_GETTER(MODE_t, mode)
-	CB_SETTER(MODE_t, mode)
+	virtual MODE_t mode(MODE_t mode);
 
 	CB_GETTER(bool, heater)
 
+	CB_GETTER(bool, ready)
+
 	CB_GETTER(bool, locked)
 	CB_SETTER(bool, locked)
 
 	CB_GETTER(unsigned long, start_time)
 
-	CB_SETTER(const String&, profile)
-	CB_GETTER(const String&, profile)
+	virtual const char * profile(const char * name) { _profile = name; return _profile.c_str(); }
+	virtual const char * profile() { return _profile.c_str(); }
 
 	CB_SETTER(unsigned long, watchdog)
 	CB_GETTER(unsigned long, watchdog)
@@ -116,22 +223,62 @@ public:
 	CB_SETTER(double, avg_rate)
 	CB_GETTER(double, avg_rate)
 
-	CB_GETTER(const String&, stage)
+	// what targets and profiles are about: the board while there is a
+	// working probe on it, the plate otherwise
+	bool cascading() { return _board.present() && !isnan(_cascade.temperature()); }
+	double measured() { return cascading() ? _cascade.temperature() : _temperature; }
+	double measured_rate() { return cascading() ? _cascade.rate() : _avg_rate; }
+	CB_GETTER(double, plate_target)
+
+	// current measure interval and the time between the last two samples
+	CB_GETTER(unsigned long, sample_interval)
+	CB_GETTER(unsigned long, sample_dt)
+
+	virtual const char * stage() { return _stage.c_str(); }
+
+	CB_GETTER(Faults&, faults)
+
+	CB_GETTER(Zones&, zones)
+
+	// per zone target offsets from target(), NULL to follow it
+	void zone_offsets(const float * offsets) { _zones.offsets(offsets); }
+
+	bool acknowledge_fault();
+
+	// forgets the learned feedforward of a profile, the current one if empty
+	void reset_ilc(const char * name);
+
+	// loads profiles.json again; the controller holds on to its profile,
+	// stages and gains, so that waits until nothing is heating
+	virtual void reload_profiles();
+
+	bool clear_fault(unsigned long now);
+
+	// Stages a command for the next tick; nothing is seen by the controller
+	// before commit(). Only one task may post.
+	bool post(COMMAND_t command, float value = 0, const char * name = NULL);
+	size_t post_space() { return _mailbox.space(); }
+	void commit() { _mailbox.publish(); }
 
 	CB_SETTER(THandlerFunction_Message, onMessage)
 	CB_SETTER(THandlerFunction_Mode, onMode)
 	CB_SETTER(THandlerFunction_Heater, onHeater)
 	CB_SETTER(THandlerFunction_Stage, onStage)
 	CB_SETTER(THandlerFunction_ReadingsReport, onReadingsReport)
+	CB_SETTER(THandlerFunction_Command, onCommand)
 
+	// gain changes are bumpless, the output carries on where it was
 	PID& setPID(float P, float I, float D);
 
-	PID& setPID(const String& name);
+	// a PID set or a gain schedule by name
+	PID& setPID(const char * name);
 
 	void resetPID();
 
 	String calibrationString();
 
+	String modelString();
+
 	const char * translate_mode(MODE_t mode = UNKNOWN);
 
 	Temperature_t temperature_to_log(float t);
@@ -139,25 +286,40 @@ public:
 	float log_to_temperature(Temperature_t t);
 
 	float measure_temperature(unsigned long now);
+	float read_thermocouple();
+	unsigned long window_phase(unsigned long now);
 	unsigned long elapsed(unsigned long now);
 
 private:
 	MAX31855 thermocouple;
+	volatile bool _ready;
+	volatile bool _self_test;
+	bool _profiles_pending;
 	bool _locked;
 	bool _heater;
 	bool _last_heater;
 	unsigned long last_m;
 	unsigned long last_log_m;
+	Sampler _sampler;
+	unsigned long _sample_interval;
+	unsigned long _sample_dt;
+	unsigned long _window_start;
+	// the duty of the current window
+	double _window_control;
 	unsigned long _start_time;
 
 	MODE_t _mode;
 	MODE_t _last_mode;
 
-	String _profile;
-	String _stage;
+	Faults _faults;
+
+	Zones _zones;
+
+	FixedString<CONFIG_TEXT> _profile;
+	Config::Name_t _stage;
 
 protected:
-	CB_SETTER(const String&, stage)
+	virtual const char * stage(const char * name) { _stage = name; return _stage.c_str(); }
 	CB_SETTER(double, temperature)
 
 	THandlerFunction_Message _onMessage;
@@ -165,19 +327,40 @@ protected:
 	THandlerFunction_Heater _onHeater;
 	THandlerFunction_Stage _onStage;
 	THandlerFunction_ReadingsReport _onReadingsReport;
+	THandlerFunction_Command _onCommand;
+
+	Seqlock<State_t> _state;
+
+	void publish(unsigned long now);
 
 	void callMessage(const char * format, ...) ;
 
 	void reportReadings(unsigned long now);
 
+	void handle_commands(unsigned long now);
+
 	virtual void handle_mode(unsigned long now);
 
 	virtual void handle_measure(unsigned long now);
 
 	virtual void handle_safety(unsigned long now);
 
+	void trip(Faults::FAULT_t code, unsigned long now);
+
+	PID& tune(float P, float I, float D);
+
+	// retune from the learned model within bounds, set per profile
+	bool _retune;
+
 	virtual void handle_pid(unsigned long now);
 
+	// caps the heater output until the next PID computation
+	// takes effect in the current window already
+	void limit_control(double limit) {
+		_target_control = min(_target_control, limit);
+		_window_control = min(_window_control, limit);
+	}
+
 	virtual void handle_reflow(unsigned long now) = 0;
 
 	virtual void handle_calibration(unsigned long now);
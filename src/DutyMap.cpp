@@ -0,0 +1,71 @@
+#include "DutyMap.h"
+
+DutyMap::DutyMap() {
+	begin(NULL);
+}
+
+void DutyMap::begin(const Table_t * table) {
+	for (int i = 0; i < DUTY_MAP_POINTS; i++) {
+		_duty[i] = table ? table->duty[i] / 255.0 : 0;
+		_samples[i] = table ? table->samples[i] : 0;
+	}
+	_learned = 0;
+}
+
+void DutyMap::pack(Table_t& table) const {
+	for (int i = 0; i < DUTY_MAP_POINTS; i++) {
+		table.duty[i] = (uint8_t)round(constrain(_duty[i], 0, 1) * 255);
+		table.samples[i] = _samples[i];
+	}
+}
+
+float DutyMap::at(float temperature) const {
+	if (isnan(temperature) || temperature <= DUTY_MAP_AMBIENT)
+		return NAN;
+	float x = constrain(temperature / DUTY_MAP_STEP, 0, DUTY_MAP_POINTS - 1);
+	int i = min((int)x, DUTY_MAP_POINTS - 2);
+	float f = x - i;
+	if (known(i) && known(i + 1))
+		return _duty[i] * (1 - f) + _duty[i + 1] * f;
+
+	// the losses grow about linearly over ambient, scale from the nearest
+	// point that is known
+	int nearest = -1;
+	for (int d = 0; d < DUTY_MAP_POINTS && nearest < 0; d++) {
+		if (known(i - d))
+			nearest = i - d;
+		else if (known(i + 1 + d))
+			nearest = i + 1 + d;
+	}
+	if (nearest < 0 || nearest * DUTY_MAP_STEP <= DUTY_MAP_AMBIENT)
+		return NAN;
+	return min(_duty[nearest] * (temperature - DUTY_MAP_AMBIENT) / (nearest * DUTY_MAP_STEP - DUTY_MAP_AMBIENT), 1.0);
+}
+
+bool DutyMap::learn(float temperature, float duty) {
+	if (isnan(temperature) || isnan(duty) || temperature < 0)
+		return false;
+	// a saturated heater says nothing about what holds the temperature
+	if (duty <= 0 || duty >= 1)
+		return false;
+	float x = temperature / DUTY_MAP_STEP;
+	int i = x;
+	if (i >= DUTY_MAP_POINTS - 1)
+		return false;
+	float f = x - i;
+
+	// shared between the two points around it; a new point takes the first
+	// samples as they come
+	float w[2] = {1 - f, f};
+	for (int k = 0; k < 2; k++) {
+		int p = i + k;
+		if (w[k] <= 0)
+			continue;
+		float rate = max(DUTY_MAP_LEARN, 1.0 / (_samples[p] + 1)) * w[k];
+		_duty[p] += (duty - _duty[p]) * rate;
+		if (w[k] >= .5 && _samples[p] < 255)
+			_samples[p]++;
+	}
+	_learned++;
+	return true;
+}
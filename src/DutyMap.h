@@ -0,0 +1,53 @@
+#ifndef DUTY_MAP_H
+#define DUTY_MAP_H
+
+#include <Arduino.h>
+
+// temperature points DUTY_MAP_STEP C apart starting at 0
+#define DUTY_MAP_POINTS 32
+#define DUTY_MAP_STEP 10
+// a hold counts once the temperature is this close to target, in C, and
+// moves slower than DUTY_MAP_RATE C/s
+#define DUTY_MAP_BAND 1.5
+#define DUTY_MAP_RATE .05
+// weight of a new sample
+#define DUTY_MAP_LEARN .02
+// samples before a point is used
+#define DUTY_MAP_MIN 20
+// where no duty holds anything, used to scale from the nearest known point
+#define DUTY_MAP_AMBIENT 25.0
+#define DUTY_MAP_FILE "/duty.bin"
+
+// Heater duty that holds a temperature, learned while the controller holds
+// one and used as feedforward, so the PID only has to make up the rest
+// rather than wind its integral up to the whole of it at every new target.
+class DutyMap {
+public:
+	typedef struct {
+		uint8_t duty[DUTY_MAP_POINTS];		// in 1/255
+		uint8_t samples[DUTY_MAP_POINTS];	// up to 255, 0 for nothing learned
+	} Table_t;
+
+	DutyMap();
+
+	void begin(const Table_t * table);
+	void pack(Table_t& table) const;
+
+	// duty that holds the temperature, NAN if nothing near it is known
+	float at(float temperature) const;
+
+	// the duty at a steady temperature; true if it was used
+	bool learn(float temperature, float duty);
+
+	// samples learned since begin()
+	uint32_t learned() const { return _learned; }
+
+private:
+	float _duty[DUTY_MAP_POINTS];
+	uint8_t _samples[DUTY_MAP_POINTS];
+	uint32_t _learned;
+
+	bool known(int i) const { return i >= 0 && i < DUTY_MAP_POINTS && _samples[i] >= DUTY_MAP_MIN; }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "EventLog.h"
+#include "Metrics.h"
+#include "Alloc.h"
+#include <esp_system.h>
+
+EventLog::EventLog(AsyncEventSource& events) :
+	_events(events),
+	_last_id(epoch()) {
+	portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+	_mux = mux;
+	memset(_log, 0, sizeof(_log));
+}
+
+uint32_t EventLog::epoch() {
+	// never 0, that is no id at all
+	uint32_t e;
+	do {
+		e = esp_random() & ~EVENT_SEQ_MASK;
+	} while (e == 0);
+	return e;
+}
+
+uint32_t EventLog::publish(const char * event, const char * format, ...) {
+	char data[EVENT_DATA_SIZE];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(data, sizeof(data), format, args);
+	va_end(args);
+
+	portENTER_CRITICAL(&_mux);
+	uint32_t id = _last_id + 1;
+	// out of numbers, clients start over with the next epoch
+	if ((id & EVENT_SEQ_MASK) == 0)
+		id = epoch() | 1;
+	Event_t& e = _log[id % EVENT_LOG_SIZE];
+	e.id = id;
+	e.event = event;
+	memcpy(e.data, data, sizeof(data));
+	_last_id = id;
+	portEXIT_CRITICAL(&_mux);
+
+	if (_events.count()) {
+		// the event source queues a copy per client
+		ALLOC_SCOPE(metrics.alloc_socket);
+		_events.send(data, event, id);
+	}
+	return id;
+}
+
+void EventLog::replay(AsyncEventSourceClient * client) {
+	uint32_t last = client->lastId();
+	uint32_t newest = _last_id;
+	uint32_t first = first_id(newest);
+	uint32_t oldest = newest >= first + EVENT_LOG_SIZE ? newest - EVENT_LOG_SIZE + 1 : first;
+
+	// a client from before a reboot, or one that missed more than we keep,
+	// has to start over from what is left
+	if (last != 0 && (first_id(last) != first || last > newest || last + 1 < oldest)) {
+		char data[64] = "";
+		sprintf(data, "{\"last\": %u, \"oldest\": %u}", last, oldest);
+		client->send(data, "reset", 0);
+		last = oldest - 1;
+	}
+
+	Event_t e;
+	for (uint32_t id = last + 1 > oldest ? last + 1 : oldest; id <= newest; id++) {
+		portENTER_CRITICAL(&_mux);
+		e = _log[id % EVENT_LOG_SIZE];
+		portEXIT_CRITICAL(&_mux);
+		// overwritten while we were sending
+		if (e.id != id)
+			continue;
+		client->send(e.data, e.event, e.id);
+	}
+}
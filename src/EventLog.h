@@ -0,0 +1,47 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <ESPAsyncWebServer.h>
+
+// ESPAsyncWebServer queues at most SSE_MAX_QUEUED_MESSAGES (32) per
+// client, a full replay plus the reset event has to fit with room left for
+// live events
+#define EVENT_LOG_SIZE 24
+#define EVENT_DATA_SIZE 96
+// ids carry a random epoch per boot above the event number, so a client
+// from before a reboot never takes ours for its own
+#define EVENT_SEQ_BITS 22
+#define EVENT_SEQ_MASK ((1UL << EVENT_SEQ_BITS) - 1)
+
+// Publishes events on an AsyncEventSource with increasing ids and keeps
+// the last EVENT_LOG_SIZE of them, so a client reconnecting with
+// Last-Event-ID gets only what it missed. A client with an id of another
+// epoch gets a reset event first.
+class EventLog {
+public:
+	EventLog(AsyncEventSource& events);
+
+	// event names are expected to be string literals
+	uint32_t publish(const char * event, const char * format, ...);
+
+	void replay(AsyncEventSourceClient * client);
+
+	uint32_t last_id() { return _last_id; }
+
+private:
+	typedef struct {
+		uint32_t id;
+		const char * event;
+		char data[EVENT_DATA_SIZE];
+	} Event_t;
+
+	AsyncEventSource& _events;
+	Event_t _log[EVENT_LOG_SIZE];
+	volatile uint32_t _last_id;
+	// the first id of the current epoch
+	uint32_t first_id(uint32_t id) const { return (id & ~EVENT_SEQ_MASK) | 1; }
+	static uint32_t epoch();
+	portMUX_TYPE _mux;
+};
+
+#endif
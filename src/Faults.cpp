@@ -0,0 +1,71 @@
+#include "Faults.h"
+
+Faults::Faults() :
+	_active(NONE),
+	_head(0),
+	_count(0) {
+}
+
+bool Faults::raise(FAULT_t code, unsigned long now, float temperature) {
+	if (_active == code)
+		return false;
+
+	_active = code;
+	Record_t& r = _history[_head];
+	r.code = code;
+	r.raised = now;
+	r.cleared = 0;
+	r.temperature = temperature;
+	r.acknowledged = false;
+	_head = (_head + 1) % FAULT_HISTORY;
+	if (_count < FAULT_HISTORY)
+		_count++;
+	return true;
+}
+
+bool Faults::acknowledge() {
+	if (_count == 0 || last().acknowledged)
+		return false;
+	last().acknowledged = true;
+	return true;
+}
+
+bool Faults::holdoff(unsigned long now) {
+	return _active != NONE && now - last().raised < FAULT_HOLDOFF;
+}
+
+bool Faults::clear(unsigned long now) {
+	if (_active == NONE || holdoff(now))
+		return false;
+	last().cleared = now;
+	_active = NONE;
+	return true;
+}
+
+const char * Faults::translate(FAULT_t code) {
+	switch (code) {
+		case NONE: return "None";
+		case HEATER_TIME: return "Heater time limit exceeded";
+		case OVER_TEMPERATURE: return "Temperature limit exceeded";
+		case PROBE: return "Error reading temperature";
+		case WATCHDOG: return "Watchdog timeout";
+		case NO_RISE: return "Temperature did not rise";
+	}
+	return "Unknown";
+}
+
+String Faults::toJSON(unsigned long now) {
+	char str[160] = "";
+	sprintf(str, "{\"active\": %d, \"fault\": \"%s\", \"holdoff\": %s, \"history\": [",
+		(int)_active, translate(_active), holdoff(now) ? "true" : "false");
+	String json = str;
+	for (int i = 0; i < _count; i++) {
+		// newest first
+		Record_t& r = _history[(_head + FAULT_HISTORY - 1 - i) % FAULT_HISTORY];
+		sprintf(str, "%s{\"code\": %d, \"fault\": \"%s\", \"raised\": %lu, \"cleared\": %lu, \"temperature\": %.2f, \"acknowledged\": %s}",
+			i ? ", " : "", (int)r.code, translate(r.code), r.raised, r.cleared, r.temperature, r.acknowledged ? "true" : "false");
+		json += str;
+	}
+	json += "]}";
+	return json;
+}
@@ -0,0 +1,62 @@
+#ifndef FAULTS_H
+#define FAULTS_H
+
+#include <Arduino.h>
+
+#define FAULT_HISTORY 16
+#define FAULT_HOLDOFF 10000
+
+class Faults {
+public:
+	typedef enum {
+		NONE = 0,
+		HEATER_TIME = 1,
+		OVER_TEMPERATURE = 2,
+		PROBE = 3,
+		WATCHDOG = 4,
+		NO_RISE = 5,
+	} FAULT_t;
+
+	typedef struct {
+		FAULT_t code;
+		unsigned long raised;
+		unsigned long cleared;
+		float temperature;
+		bool acknowledged;
+	} Record_t;
+
+	Faults();
+
+	// latch a fault; a fault that is already active is not recorded again
+	bool raise(FAULT_t code, unsigned long now, float temperature);
+
+	bool acknowledge();
+
+	// release the latch once the hold-off has passed
+	bool clear(unsigned long now);
+
+	bool active() { return _active != NONE; }
+	FAULT_t code() { return _active; }
+	bool holdoff(unsigned long now);
+
+	// faults that clear by themselves once the hold-off has passed and the
+	// cause is gone; the rest need a clear command
+	static bool self_clearing(FAULT_t code) { return code == WATCHDOG; }
+
+	// latest record
+	Record_t& history() { return last(); }
+
+	static const char * translate(FAULT_t code);
+
+	String toJSON(unsigned long now);
+
+private:
+	FAULT_t _active;
+	Record_t _history[FAULT_HISTORY];
+	uint8_t _head;
+	uint8_t _count;
+
+	Record_t& last() { return _history[(_head + FAULT_HISTORY - 1) % FAULT_HISTORY]; }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <Arduino.h>
+
+// Fixed capacity, NUL terminated string. Assignments that don't fit are
+// truncated; nothing here ever touches the heap.
+template<size_t N>
+class FixedString {
+public:
+	FixedString() { _s[0] = 0; }
+	FixedString(const char * s) { assign(s); }
+
+	FixedString& operator=(const char * s) { assign(s); return *this; }
+
+	void assign(const char * s) {
+		size_t i = 0;
+		for (; s && s[i] && i < N - 1; i++)
+			_s[i] = s[i];
+		_s[i] = 0;
+	}
+
+	int printf(const char * format, ...) {
+		va_list args;
+		va_start(args, format);
+		int n = vsnprintf(_s, N, format, args);
+		va_end(args);
+		return n;
+	}
+
+	bool operator==(const char * s) const { return strcmp(_s, s ? s : "") == 0; }
+	bool operator!=(const char * s) const { return !(*this == s); }
+
+	const char * c_str() const { return _s; }
+	operator const char *() const { return _s; }
+	size_t length() const { return strlen(_s); }
+	bool empty() const { return _s[0] == 0; }
+	static size_t capacity() { return N - 1; }
+
+private:
+	char _s[N];
+};
+
+// Fixed capacity table of items looked up by their `id` member. Storage is
+// part of the owner, clear() just forgets the items.
+template<typename T, size_t N>
+class FixedTable {
+public:
+	typedef T * iterator;
+
+	FixedTable() : _count(0) {}
+
+	iterator begin() { return _items; }
+	iterator end() { return _items + _count; }
+
+	iterator find(const char * id) {
+		for (size_t i = 0; i < _count; i++)
+			if (_items[i].id == id)
+				return &_items[i];
+		return end();
+	}
+
+	// a new item at the end, NULL when the table is full
+	T * add() {
+		if (_count >= N)
+			return NULL;
+		_items[_count] = T();
+		return &_items[_count++];
+	}
+
+	// drops the last item
+	void pop() { if (_count) _count--; }
+	void clear() { _count = 0; }
+	size_t size() const { return _count; }
+	static size_t capacity() { return N; }
+
+private:
+	T _items[N];
+	size_t _count;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "Frames.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// template pieces, with their lengths known at compile time
+#define LIT(s) s, sizeof(s) - 1
+
+FrameWriter::FrameWriter(char * buffer, size_t size) :
+	_buf(buffer),
+	_size(size),
+	_len(0),
+	_truncated(false),
+	_cut(false) {
+	_buf[0] = 0;
+}
+
+const char * FrameWriter::message(const char * message) {
+	begin();
+	raw(LIT("{\"message\":\""));
+	string(message);
+	return end(LIT("\"}"));
+}
+
+const char * FrameWriter::heater(bool heater) {
+	begin();
+	raw(LIT("{\"heater\":"));
+	boolean(heater);
+	return end(LIT("}"));
+}
+
+const char * FrameWriter::mode(const char * mode) {
+	begin();
+	raw(LIT("{\"mode\":\""));
+	string(mode);
+	return end(LIT("\"}"));
+}
+
+const char * FrameWriter::stage(const char * stage, float target) {
+	begin();
+	raw(LIT("{\"stage\":\""));
+	string(stage);
+	raw(LIT("\",\"target\":"));
+	number(target, 2);
+	return end(LIT("}"));
+}
+
+const char * FrameWriter::target(float target) {
+	begin();
+	raw(LIT("{\"target\":"));
+	number(target, 2);
+	return end(LIT("}"));
+}
+
+const char * FrameWriter::profile(const char * profile) {
+	begin();
+	raw(LIT("{\"profile\":\""));
+	string(profile);
+	return end(LIT("\"}"));
+}
+
+const char * FrameWriter::reading(float time, float reading, float target, bool reset, unsigned long seq) {
+	begin();
+	raw(LIT("{\"times\":["));
+	number(time, 1);
+	raw(LIT("],\"readings\":["));
+	number(reading, 2);
+	raw(LIT("],\"targets\":["));
+	number(target, 2);
+	raw(LIT("],\"reset\":"));
+	boolean(reset);
+	if (seq) {
+		raw(LIT(",\"seq\":"));
+		number(seq);
+	}
+	return end(LIT("}"));
+}
+
+const char * FrameWriter::ack(unsigned long id, double t, unsigned long us) {
+	request(id, t);
+	raw(LIT(",\"ok\":true,\"us\":"));
+	number(us);
+	return end(LIT("}"));
+}
+
+const char * FrameWriter::nack(unsigned long id, double t, int index, const char * error) {
+	request(id, t);
+	raw(LIT(",\"ok\":false,\"index\":"));
+	if (index < 0)
+		raw(LIT("null"));
+	else
+		number((unsigned long)index);
+	raw(LIT(",\"error\":\""));
+	string(error);
+	return end(LIT("\"}"));
+}
+
+void FrameWriter::request(unsigned long id, double t) {
+	begin();
+	raw(LIT("{\"ack\":"));
+	number(id);
+	if (!isnan(t)) {
+		raw(LIT(",\"t\":"));
+		real(t);
+	}
+}
+
+void FrameWriter::begin() {
+	_len = 0;
+	_truncated = false;
+	_cut = false;
+}
+
+void FrameWriter::raw(const char * s, size_t len, size_t reserve) {
+	if (_truncated || _len + len + reserve >= _size) {
+		_truncated = true;
+		return;
+	}
+	memcpy(_buf + _len, s, len);
+	_len += len;
+}
+
+void FrameWriter::string(const char * s) {
+	static const char hex[] = "0123456789abcdef";
+	if (!s)
+		return;
+	while (*s && !_truncated) {
+		// copy runs of plain characters in one go
+		const char * run = s;
+		while ((unsigned char)*s >= 0x20 && *s != '"' && *s != '\\')
+			s++;
+		if (s != run) {
+			// a long value is cut off, not dropped
+			size_t room = _len + FRAME_TAIL < _size ? _size - _len - FRAME_TAIL - 1 : 0;
+			if ((size_t)(s - run) > room)
+				s = run + room;
+			raw(run, s - run);
+			if ((size_t)(s - run) == room && *s) {
+				_cut = true;
+				break;
+			}
+		}
+		if (!*s || _truncated)
+			break;
+
+		char c = *s++;
+		if (c == '"' || c == '\\') {
+			char e[2] = {'\\', c};
+			raw(e, 2);
+		} else if (c == '\n') {
+			raw(LIT("\\n"));
+		} else {
+			char e[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+			raw(e, 6);
+		}
+	}
+}
+
+void FrameWriter::number(float f, int decimals) {
+	// JSON has no NaN, a failed probe reads as null
+	if (isnan(f) || isinf(f)) {
+		raw(LIT("null"));
+		return;
+	}
+	if (fabs(f) >= 1e9) {
+		char str[24];
+		raw(str, snprintf(str, sizeof(str), "%g", f));
+		return;
+	}
+
+	// fixed point: temperatures and times never need more than that
+	static const uint32_t scale[] = {1, 10, 100, 1000};
+	char str[24];
+	char * p = str + sizeof(str);
+	bool negative = f < 0;
+	uint64_t v = (uint64_t)((negative ? -f : f) * scale[decimals] + 0.5f);
+	for (int i = 0; i < decimals; i++) {
+		*--p = '0' + v % 10;
+		v /= 10;
+	}
+	if (decimals)
+		*--p = '.';
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	if (negative)
+		*--p = '-';
+	raw(p, str + sizeof(str) - p);
+}
+
+void FrameWriter::number(unsigned long n) {
+	char str[24];
+	char * p = str + sizeof(str);
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	raw(p, str + sizeof(str) - p);
+}
+
+// client timestamps are echoed as they came, with all their digits
+void FrameWriter::real(double d) {
+	char str[32];
+	raw(str, snprintf(str, sizeof(str), "%.15g", d));
+}
+
+void FrameWriter::boolean(bool b) {
+	if (b)
+		raw(LIT("true"));
+	else
+		raw(LIT("false"));
+}
+
+const char * FrameWriter::end(const char * tail, size_t len) {
+	// a frame that lost more than the end of a string value is useless
+	if (_truncated) {
+		_len = 0;
+		_truncated = false;
+		raw(LIT("{}"), 0);
+		_truncated = true;
+	} else
+		raw(tail, len, 0);
+	_buf[_len] = 0;
+	return _buf;
+}
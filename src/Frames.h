@@ -0,0 +1,61 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// large enough for a 512 byte controller message with some escaping
+#define FRAME_SIZE 640
+// room kept for closing a frame when a value gets cut off
+#define FRAME_TAIL 16
+
+// Writes the JSON frames of the controller events straight into a caller
+// supplied buffer. Every event has a fixed template, only the values are
+// formatted. No heap, no intermediate JSON tree. A string value that
+// doesn't fit is cut off; a frame that doesn't fit otherwise comes out as {}.
+class FrameWriter {
+public:
+	FrameWriter(char * buffer, size_t size);
+
+	const char * message(const char * message);
+	const char * heater(bool heater);
+	const char * mode(const char * mode);
+	const char * stage(const char * stage, float target);
+	const char * target(float target);
+	const char * profile(const char * profile);
+	const char * reading(float time, float reading, float target, bool reset, unsigned long seq);
+	// command replies, `t` is the sender's timestamp, NAN if it sent none
+	const char * ack(unsigned long id, double t, unsigned long us);
+	const char * nack(unsigned long id, double t, int index, const char * error);
+
+	const char * c_str() const { return _buf; }
+	size_t length() const { return _len; }
+	bool truncated() const { return _truncated || _cut; }
+
+private:
+	char * _buf;
+	size_t _size;
+	size_t _len;
+	bool _truncated;
+	bool _cut;
+
+	void begin();
+	void raw(const char * s, size_t len, size_t reserve = FRAME_TAIL);
+	void string(const char * s);
+	void number(float f, int decimals);
+	void number(unsigned long n);
+	void real(double d);
+	void request(unsigned long id, double t);
+	void boolean(bool b);
+	const char * end(const char * tail, size_t len);
+};
+
+// A writer with its own frame, meant to live on the stack of the sender.
+class Frame : public FrameWriter {
+public:
+	Frame() : FrameWriter(_frame, sizeof(_frame)) {}
+private:
+	char _frame[FRAME_SIZE];
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "Ilc.h"
+
+Ilc::Ilc() {
+	clear();
+	begin(NULL);
+}
+
+void Ilc::clear() {
+	memset(&_table, 0, sizeof(_table));
+}
+
+void Ilc::begin(const Table_t * table) {
+	if (table)
+		_table = *table;
+	memset(_error, 0, sizeof(_error));
+	memset(_count, 0, sizeof(_count));
+}
+
+float Ilc::at(unsigned long elapsed) const {
+	// between the centers of two bins
+	float x = (float)elapsed / ILC_BIN - .5;
+	if (x <= 0)
+		return value(_table.bins[0]);
+	int i = x;
+	if (i >= ILC_BINS - 1)
+		return value(_table.bins[ILC_BINS - 1]);
+	float f = x - i;
+	return value(_table.bins[i]) * (1 - f) + value(_table.bins[i + 1]) * f;
+}
+
+void Ilc::track(unsigned long elapsed, float error, float control) {
+	unsigned long i = elapsed / ILC_BIN;
+	if (i >= ILC_BINS || isnan(error))
+		return;
+	// too hot with the heater off, or too cold at full power
+	if ((error < 0 && control <= 0) || (error > 0 && control >= 1))
+		return;
+	_error[i] += error;
+	_count[i]++;
+}
+
+float Ilc::learn() {
+	float updated[ILC_BINS];
+	float total = 0;
+	int bins = 0;
+	for (int i = 0; i < ILC_BINS; i++) {
+		updated[i] = value(_table.bins[i]);
+		if (_count[i]) {
+			total += fabs(_error[i] / _count[i]);
+			bins++;
+		}
+		int k = i + ILC_LEAD;
+		if (k < ILC_BINS && _count[k])
+			updated[i] += ILC_GAIN * _error[k] / _count[k];
+	}
+
+	// a [1 2 1] filter keeps noise from building up over the runs
+	for (int i = 0; i < ILC_BINS; i++) {
+		float before = updated[max(i - 1, 0)];
+		float after = updated[min(i + 1, ILC_BINS - 1)];
+		float v = (before + 2 * updated[i] + after) / 4;
+		v = constrain(v, -ILC_LIMIT, ILC_LIMIT);
+		_table.bins[i] = (int8_t)round(v * 127 / ILC_LIMIT);
+	}
+	_table.runs++;
+	begin(NULL);
+	return bins ? total / bins : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef ILC_H
+#define ILC_H
+
+#include <Arduino.h>
+
+// run time per table entry, ILC_BINS of them cover a bit over 10 minutes
+#define ILC_BINS 128
+#define ILC_BIN 5000
+// duty added per C of mean tracking error in a bin, each run
+#define ILC_GAIN .01
+// bins a correction comes ahead of the error it answers, about the dead
+// time plus the lag of the heater
+#define ILC_LEAD 1
+// largest correction either way, in duty
+#define ILC_LIMIT .3
+#define ILC_FILE "/ilc.bin"
+
+// Iterative learning control: a feedforward table over time into a run of
+// a profile. Runs of the same profile make the same errors at the same
+// time, so after each successful run the table moves by the run's tracking
+// error, a little ahead in time, smoothed and within bounds.
+class Ilc {
+public:
+	typedef struct {
+		uint16_t runs;
+		int8_t bins[ILC_BINS];		// in ILC_LIMIT / 127
+	} Table_t;
+
+	Ilc();
+
+	// start of a run, with the table learned so far
+	void begin(const Table_t * table);
+
+	// feedforward at elapsed ms into the run
+	float at(unsigned long elapsed) const;
+
+	// target - temperature at elapsed ms into the run, with the heater
+	// output at the time; errors the heater couldn't act on are left out
+	void track(unsigned long elapsed, float error, float control);
+
+	// folds the run into the table; returns the run's mean |error|
+	float learn();
+
+	void clear();
+
+	Table_t& table() { return _table; }
+
+private:
+	Table_t _table;
+	float _error[ILC_BINS];
+	uint16_t _count[ILC_BINS];
+
+	static float value(int8_t bin) { return bin * ILC_LIMIT / 127; }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <Arduino.h>
+
+// Single producer, single consumer ring without locks. The producer stages
+// items with push() and makes all of them visible at once with publish(),
+// so the consumer sees a batch either whole or not at all. Neither side
+// ever waits: push() fails when the ring is full.
+template<typename T, size_t N>
+class Mailbox {
+	// the free running counters wrap cleanly only for a power of two
+	static_assert((N & (N - 1)) == 0, "Mailbox size must be a power of two");
+public:
+	Mailbox() : _head(0), _tail(0), _staged(0) {}
+
+	// producer side
+	size_t space() const {
+		return N - (_staged - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE));
+	}
+
+	bool push(const T& item) {
+		if (space() == 0)
+			return false;
+		_items[_staged % N] = item;
+		_staged++;
+		return true;
+	}
+
+	void publish() {
+		__atomic_store_n(&_head, _staged, __ATOMIC_RELEASE);
+	}
+
+	void discard() {
+		_staged = _head;
+	}
+
+	// consumer side
+	bool pop(T& item) {
+		if (_tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+			return false;
+		item = _items[_tail % N];
+		__atomic_store_n(&_tail, _tail + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+private:
+	T _items[N];
+	uint32_t _head;
+	uint32_t _tail;
+	uint32_t _staged;
+};
+
+#endif
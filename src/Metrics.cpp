@@ -0,0 +1,61 @@
+#include "Metrics.h"
+#include <esp_heap_caps.h>
+#include "Alloc.h"
+
+Metrics metrics;
+
+Metrics::Metrics() :
+	messages(0),
+	dropped(0),
+	sample_interval(0),
+	alloc_tick(0),
+	alloc_message(0),
+	alloc_socket(0) {
+}
+
+void Metrics::histogram(AsyncResponseStream * out, const char * name, const char * help, Histogram& h) {
+	out->printf("# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	uint32_t cumulative = 0;
+	for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+		cumulative += h.counts[i];
+		out->printf("%s_bucket{le=\"%g\"} %u\n", name, (1UL << i) / 1e6, cumulative);
+	}
+	out->printf("%s_bucket{le=\"+Inf\"} %u\n", name, h.count);
+	out->printf("%s_sum %g\n%s_count %u\n", name, h.sum / 1e6, name, h.count);
+}
+
+void Metrics::render(AsyncResponseStream * out, AsyncWebSocket& ws) {
+	histogram(out, "reflow_loop_seconds", "Duration of one controller loop()", loop);
+	histogram(out, "reflow_measure_seconds", "Duration of handle_measure()", measure);
+	histogram(out, "reflow_pid_seconds", "Duration of handle_pid()", pid);
+	histogram(out, "reflow_sample_jitter_seconds", "Deviation of the measure interval from the one chosen", jitter);
+	histogram(out, "reflow_thermocouple_read_seconds", "Duration of a thermocouple read", thermocouple);
+	histogram(out, "reflow_broadcast_seconds", "Duration of flushing pending frames to one WebSocket client", broadcast);
+
+	out->printf("# HELP reflow_ws_messages_total Messages queued to WebSocket clients\n# TYPE reflow_ws_messages_total counter\nreflow_ws_messages_total %u\n", messages);
+	out->printf("# HELP reflow_ws_dropped_total Messages dropped because a client queue was full\n# TYPE reflow_ws_dropped_total counter\nreflow_ws_dropped_total %u\n", dropped);
+
+#ifdef ALLOC_COUNT
+	out->printf("# HELP reflow_allocations_total Heap allocations from the loop task by where they happened\n# TYPE reflow_allocations_total counter\n");
+	out->printf("reflow_allocations_total{site=\"tick\"} %u\n", alloc_tick);
+	out->printf("reflow_allocations_total{site=\"message\"} %u\n", alloc_message);
+	out->printf("reflow_allocations_total{site=\"socket\"} %u\n", alloc_socket);
+	out->printf("reflow_allocations_total{site=\"other\"} %u\n", alloc_count() - alloc_tick - alloc_message - alloc_socket);
+#endif
+
+	out->printf("# HELP reflow_ws_queue_length Outbound queue length per WebSocket client\n# TYPE reflow_ws_queue_length gauge\n");
+	uint32_t id = 0;
+	for (size_t count = 0; count < ws.count(); id++) {
+		if (ws.hasClient(id)) {
+			out->printf("reflow_ws_queue_length{client=\"%u\"} %u\n", id, ws.client(id)->queueLen());
+			count++;
+		}
+	}
+
+	out->printf("# HELP reflow_heap_free_bytes Free heap\n# TYPE reflow_heap_free_bytes gauge\nreflow_heap_free_bytes %u\n", ESP.getFreeHeap());
+	out->printf("# HELP reflow_heap_largest_free_block_bytes Largest allocatable block\n# TYPE reflow_heap_largest_free_block_bytes gauge\nreflow_heap_largest_free_block_bytes %u\n",
+		heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+	out->printf("# HELP reflow_sample_interval_seconds Current thermocouple sample interval\n# TYPE reflow_sample_interval_seconds gauge\nreflow_sample_interval_seconds %g\n", sample_interval / 1000.0);
+	out->printf("# HELP reflow_heap_min_free_bytes Lowest free heap since boot\n# TYPE reflow_heap_min_free_bytes gauge\nreflow_heap_min_free_bytes %u\n", ESP.getMinFreeHeap());
+	out->printf("# HELP reflow_uptime_seconds Time since boot\n# TYPE reflow_uptime_seconds counter\nreflow_uptime_seconds %lu\n", millis() / 1000);
+}
@@ -0,0 +1,67 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// bucket i counts durations up to 2^i us, the last one everything above
+#define METRICS_BUCKETS 21
+
+// Log2 bucketed histogram of durations in microseconds. Updates are a
+// count-leading-zeros and three increments; they are not atomic, a lost
+// count when two tasks collide is acceptable here.
+class Histogram {
+public:
+	Histogram() : sum(0), count(0) { memset(counts, 0, sizeof(counts)); }
+
+	void observe(uint32_t us) {
+		int i = us <= 1 ? 0 : 32 - __builtin_clz(us - 1);
+		counts[i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1]++;
+		sum += us;
+		count++;
+	}
+
+	uint32_t counts[METRICS_BUCKETS];
+	uint64_t sum;
+	uint32_t count;
+};
+
+// Times the enclosing scope into a histogram.
+class MetricsTimer {
+public:
+	MetricsTimer(Histogram& h) : _h(h), _start(micros()) {}
+	~MetricsTimer() { _h.observe(micros() - _start); }
+private:
+	Histogram& _h;
+	uint32_t _start;
+};
+
+class Metrics {
+public:
+	Histogram loop;
+	Histogram measure;
+	Histogram pid;
+	Histogram jitter;
+	Histogram thermocouple;
+	Histogram broadcast;
+
+	uint32_t messages;
+	uint32_t dropped;
+	uint32_t sample_interval;
+
+	// heap allocations from the loop task, see Alloc.h
+	uint32_t alloc_tick;
+	uint32_t alloc_message;
+	uint32_t alloc_socket;
+
+	Metrics();
+
+	void render(AsyncResponseStream * out, AsyncWebSocket& ws);
+
+private:
+	void histogram(AsyncResponseStream * out, const char * name, const char * help, Histogram& h);
+};
+
+extern Metrics metrics;
+
+#endif
@@ -0,0 +1,158 @@
+#include "Model.h"
+
+// covariance beyond which forgetting stops, so it doesn't blow up while
+// nothing moves during a hold
+#define MODEL_P_MAX 10000.0
+
+Model::Model() :
+	_head(0),
+	_count(0),
+	_on(false),
+	_fit_time(0),
+	_fit_temperature(NAN) {
+	memset(&_params, 0, sizeof(_params));
+	for (int d = 0; d < MODEL_DELAYS; d++)
+		reset(_est[d], MODEL_P0);
+}
+
+void Model::reset(Estimator_t& e, float p0) {
+	memset(&e, 0, sizeof(e));
+	for (int i = 0; i < 3; i++)
+		e.P[i][i] = p0;
+}
+
+void Model::begin(unsigned long now, const Params_t * seed) {
+	memset(&_params, 0, sizeof(_params));
+	for (int d = 0; d < MODEL_DELAYS; d++) {
+		if (seed && seed->tau > 0) {
+			// temperatures are scaled by 1/100 in the regressor
+			reset(_est[d], MODEL_P_SEED);
+			_est[d].theta[0] = 100.0 / seed->tau;
+			_est[d].theta[1] = seed->gain / seed->tau;
+			_est[d].theta[2] = 25.0 / seed->tau;
+		} else
+			reset(_est[d], MODEL_P0);
+	}
+	if (seed)
+		_params = *seed;
+
+	// nothing is known from before the run
+	_edges[0] = now;
+	_states[0] = _on;
+	_head = _count = 1;
+	_fit_time = now;
+	_fit_temperature = NAN;
+}
+
+void Model::heater(unsigned long now, bool on) {
+	if (on == _on)
+		return;
+	_on = on;
+	_edges[_head] = now;
+	_states[_head] = on;
+	_head = (_head + 1) % MODEL_HISTORY;
+	if (_count < MODEL_HISTORY)
+		_count++;
+}
+
+float Model::duty(unsigned long from, unsigned long to) const {
+	if (_count == 0 || to == from)
+		return NAN;
+	unsigned long end = to;
+	unsigned long on = 0;
+	for (int n = 0; n < _count; n++) {
+		int i = (_head + MODEL_HISTORY - 1 - n) % MODEL_HISTORY;
+		unsigned long start = _edges[i];
+		if ((long)(start - to) < 0) {
+			unsigned long from_here = (long)(start - from) > 0 ? start : from;
+			if (_states[i] && (long)(end - from_here) > 0)
+				on += end - from_here;
+			end = start;
+		}
+		if ((long)(start - from) <= 0)
+			return (float)on / (to - from);
+	}
+	return NAN;
+}
+
+void Model::fit(Estimator_t& e, const float * phi, float y) {
+	float Pphi[3];
+	float den = MODEL_FORGET;
+	float error = y;
+	for (int i = 0; i < 3; i++) {
+		Pphi[i] = 0;
+		for (int j = 0; j < 3; j++)
+			Pphi[i] += e.P[i][j] * phi[j];
+		den += phi[i] * Pphi[i];
+		error -= phi[i] * e.theta[i];
+	}
+	e.cost = e.cost * MODEL_FORGET + error * error * (1 - MODEL_FORGET);
+
+	bool forget = e.P[0][0] + e.P[1][1] + e.P[2][2] < MODEL_P_MAX;
+	for (int i = 0; i < 3; i++) {
+		float k = Pphi[i] / den;
+		e.theta[i] += k * error;
+		for (int j = 0; j < 3; j++) {
+			e.P[i][j] -= k * Pphi[j];
+			if (forget)
+				e.P[i][j] /= MODEL_FORGET;
+		}
+	}
+}
+
+void Model::measure(unsigned long now, float temperature) {
+	if (isnan(temperature))
+		return;
+	if (isnan(_fit_temperature)) {
+		_fit_time = now;
+		_fit_temperature = temperature;
+		return;
+	}
+	if (now - _fit_time < MODEL_STEP)
+		return;
+
+	float y = 1000.0 * (temperature - _fit_temperature) / (now - _fit_time);
+	float phi[3] = {-(temperature + _fit_temperature) / 200, 0, 1};
+	int best = -1;
+	for (int d = 0; d < MODEL_DELAYS; d++) {
+		unsigned long delay = d * MODEL_DELAY_STEP;
+		phi[1] = duty(_fit_time - delay, now - delay);
+		if (isnan(phi[1]))
+			continue;
+		fit(_est[d], phi, y);
+		if (best < 0 || _est[d].cost < _est[best].cost)
+			best = d;
+	}
+	_fit_time = now;
+	_fit_temperature = temperature;
+
+	if (best < 0)
+		return;
+	const float * theta = _est[best].theta;
+	if (theta[0] <= 0 || theta[1] <= 0)
+		return;
+	_params.tau = 100.0 / theta[0];
+	_params.gain = theta[1] * _params.tau;
+	_params.dead = best * MODEL_DELAY_STEP / 1000.0;
+	_params.fits++;
+}
+
+bool Model::valid(const Params_t& params) {
+	return params.fits >= MODEL_MIN_FITS && params.tau > 0 && params.tau < MODEL_TAU_MAX && params.gain > 0 && isfinite(params.gain);
+}
+
+void Model::retune(float& P, float& I, float& D) const {
+	if (!valid() || P <= 0)
+		return;
+	// SIMC with the closed loop time constant at the dead time, at least one
+	// fit step so a tiny dead time doesn't ask for huge gains
+	float theta = max(_params.dead, MODEL_STEP / 1000.0f);
+	float Kc = _params.tau / (_params.gain * 2 * theta);
+	float Ti = min(_params.tau, 8 * theta);
+
+	float ratio = constrain(Kc / P, 1 / MODEL_BOUND, MODEL_BOUND);
+	float Ki = constrain(P * ratio / Ti, I / MODEL_BOUND, I * MODEL_BOUND);
+	P *= ratio;
+	I = Ki;
+	D *= ratio;
+}
@@ -0,0 +1,83 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <Arduino.h>
+
+// dead time candidates, MODEL_DELAY_STEP ms apart starting at 0
+#define MODEL_DELAYS 8
+#define MODEL_DELAY_STEP 2000
+// ms between two fits
+#define MODEL_STEP 2000
+// heater edges kept, enough for the longest dead time at full PWM
+#define MODEL_HISTORY 128
+#define MODEL_FORGET .995
+// covariance of a fresh estimator, and of one seeded from a saved model
+#define MODEL_P0 100.0
+#define MODEL_P_SEED .1
+// fits before a model is trusted, and the slowest plant believed
+#define MODEL_MIN_FITS 30
+#define MODEL_TAU_MAX 1000
+// retuned gains stay within 1/MODEL_BOUND .. MODEL_BOUND x the configured ones
+#define MODEL_BOUND 2.0
+#define MODEL_FILE "/models.bin"
+
+// First order plus dead time model of the oven with its load,
+//   dT/dt = (K * u(t - dead) - (T - ambient)) / tau
+// with u the heater duty. One recursive least squares estimator per dead
+// time candidate runs on the measured temperature and the relay edges, the
+// candidate predicting best gives the dead time.
+class Model {
+public:
+	typedef struct {
+		float gain;			// C per unit of duty
+		float tau;			// s
+		float dead;			// s
+		uint32_t fits;
+	} Params_t;
+
+	Model();
+
+	// start of a run, from a saved model if there is one
+	void begin(unsigned long now, const Params_t * seed);
+
+	// the relay, every tick
+	void heater(unsigned long now, bool on);
+
+	void measure(unsigned long now, float temperature);
+
+	bool valid() const { return valid(_params); }
+	static bool valid(const Params_t& params);
+
+	const Params_t& params() const { return _params; }
+
+	// SIMC tuning from the model, bounded around the configured gains
+	void retune(float& P, float& I, float& D) const;
+
+private:
+	typedef struct {
+		float theta[3];
+		float P[3][3];
+		float cost;
+	} Estimator_t;
+
+	Estimator_t _est[MODEL_DELAYS];
+	Params_t _params;
+
+	unsigned long _edges[MODEL_HISTORY];
+	bool _states[MODEL_HISTORY];
+	uint8_t _head;
+	uint8_t _count;
+	bool _on;
+
+	unsigned long _fit_time;
+	float _fit_temperature;
+
+	void reset(Estimator_t& e, float p0);
+
+	// fraction of [from, to) the heater was on, NAN if that is too far back
+	float duty(unsigned long from, unsigned long to) const;
+
+	void fit(Estimator_t& e, const float * phi, float y);
+};
+
+#endif
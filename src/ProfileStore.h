@@ -0,0 +1,85 @@
+#ifndef PROFILE_STORE_H
+#define PROFILE_STORE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <SPIFFS.h>
+#include "Config.h"
+
+// Something learned per profile, kept in one SPIFFS file of PROFILES_MAX
+// fixed size records. When all are taken, the one saved longest ago goes.
+// Reads and writes the whole file, only use it while the heater is off.
+template<typename T>
+class ProfileStore {
+public:
+	ProfileStore(const char * file) : _file(file) {}
+
+	bool load(const char * profile, T& data) {
+		Record_t records[PROFILES_MAX];
+		int i = find(records, profile);
+		if (!records[i].age || strncmp(records[i].profile, profile, CONFIG_NAME) != 0)
+			return false;
+		data = records[i].data;
+		return true;
+	}
+
+	bool save(const char * profile, const T& data) {
+		Record_t records[PROFILES_MAX];
+		int i = find(records, profile);
+		uint32_t age = 0;
+		for (int k = 0; k < PROFILES_MAX; k++)
+			age = max(age, records[k].age);
+		strncpy(records[i].profile, profile, CONFIG_NAME - 1);
+		records[i].profile[CONFIG_NAME - 1] = 0;
+		records[i].age = age + 1;
+		records[i].data = data;
+		return write(records);
+	}
+
+	bool remove(const char * profile) {
+		Record_t records[PROFILES_MAX];
+		int i = find(records, profile);
+		if (!records[i].age || strncmp(records[i].profile, profile, CONFIG_NAME) != 0)
+			return false;
+		memset(&records[i], 0, sizeof(Record_t));
+		return write(records);
+	}
+
+private:
+	typedef struct {
+		char profile[CONFIG_NAME];
+		uint32_t age;			// 0 for an empty slot
+		T data;
+	} Record_t;
+
+	const char * _file;
+
+	// reads all records, returns the profile's slot or the one to reuse
+	int find(Record_t * records, const char * profile) {
+		memset(records, 0, sizeof(Record_t) * PROFILES_MAX);
+		File f = SPIFFS.open(_file, "r");
+		if (f) {
+			f.read((uint8_t *)records, sizeof(Record_t) * PROFILES_MAX);
+			f.close();
+		}
+		int oldest = 0;
+		for (int i = 0; i < PROFILES_MAX; i++) {
+			if (records[i].age && strncmp(records[i].profile, profile, CONFIG_NAME) == 0)
+				return i;
+			if (records[i].age < records[oldest].age)
+				oldest = i;
+		}
+		return oldest;
+	}
+
+	bool write(const Record_t * records) {
+		File f = SPIFFS.open(_file, "w");
+		if (!f)
+			return false;
+		f.write((const uint8_t *)records, sizeof(Record_t) * PROFILES_MAX);
+		f.close();
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "Program.h"
+
+bool Program::emit(OP_t op, uint8_t arg, uint16_t jump, float value) {
+	if (size == PROGRAM_SIZE)
+		return false;
+	Instr_t& i = code[size++];
+	i.op = op;
+	i.arg = arg;
+	i.jump = jump;
+	i.value = value;
+	return true;
+}
+
+ProgramRunner::ProgramRunner() :
+	_program(NULL),
+	_pc(0),
+	_mark(0),
+	_stage_mark(0),
+	_stage(0),
+	_direction(0),
+	_above(NAN),
+	_timeout(0),
+	_why("") {
+	memset(_counters, 0, sizeof(_counters));
+}
+
+void ProgramRunner::begin(const Program * program, unsigned long now) {
+	_program = program;
+	_pc = 0;
+	_mark = _stage_mark = now;
+	_stage = 0;
+	_direction = 0;
+	memset(_counters, 0, sizeof(_counters));
+	_above = NAN;
+	_timeout = 0;
+	_why = "";
+}
+
+ProgramRunner::EVENT_t ProgramRunner::step(unsigned long now, const Inputs_t& in) {
+	if (!_program)
+		return NONE;
+
+	if (in.temperature > _above) {
+		_why = "temperature above the profile's limit";
+		_program = NULL;
+		return ABORT;
+	}
+	if (_timeout > 0 && now - _stage_mark > _timeout * 1000) {
+		_why = "stage took longer than its timeout";
+		_program = NULL;
+		return ABORT;
+	}
+
+	for (int n = 0; n < PROGRAM_STEPS; n++) {
+		if (_pc >= _program->size) {
+			_program = NULL;
+			return DONE;
+		}
+		const Program::Instr_t& i = _program->code[_pc];
+		switch (i.op) {
+			case Program::END:
+				_program = NULL;
+				return DONE;
+			case Program::STAGE:
+				_stage = i.arg;
+				_stage_mark = now;
+				_direction = 0;
+				_timeout = 0;
+				next(now);
+				return ENTER;
+			case Program::REACH:
+				if (_direction == 0)
+					_direction = i.value >= in.temperature ? 1 : -1;
+				if (_direction * (in.temperature - i.value) <= 0)
+					return NONE;
+				next(now);
+				return REACHED;
+			case Program::STAY:
+				if (now - _mark <= i.value * 1000)
+					return NONE;
+				break;
+			case Program::RATE:
+				if (isnan(in.rate) || fabs(in.rate) >= i.value)
+					return NONE;
+				break;
+			case Program::ZONE:
+				// a missing zone never gets there, the stage's timeout has to end it
+				if (i.arg >= in.zone_count || isnan(in.zones[i.arg]) || fabs(in.zones[i.arg] - in.temperature) >= i.value)
+					return NONE;
+				break;
+			case Program::LOOP:
+				if (_counters[i.arg] < i.value) {
+					_counters[i.arg]++;
+					_pc = i.jump;
+					_mark = now;
+					continue;
+				}
+				_counters[i.arg] = 0;
+				break;
+			case Program::ABOVE:
+				_above = i.value;
+				break;
+			case Program::TIMEOUT:
+				_timeout = i.value;
+				break;
+		}
+		next(now);
+	}
+	return NONE;
+}
@@ -0,0 +1,97 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <Arduino.h>
+
+// instructions per profile, and loop counters and instructions run per tick
+#define PROGRAM_SIZE 64
+#define PROGRAM_COUNTERS 4
+#define PROGRAM_STEPS 8
+
+// A profile compiled to a short list of instructions. Every stage becomes
+//   STAGE n; [TIMEOUT s]; REACH target; STAY s; [RATE r]; [ZONE z, d]; [LOOP c, to, n]
+// after the profile wide guards (ABOVE t), and the program ends with END.
+// Waiting instructions hold the program counter until their condition
+// holds, guards are checked on every tick.
+class Program {
+public:
+	typedef enum : uint8_t {
+		END,
+		STAGE,		// arg: stage index
+		REACH,		// value: stage target, passed in the stage's direction
+		STAY,		// value: s since the previous instruction finished
+		RATE,		// value: C/s the rate has to drop below
+		ZONE,		// arg: zone, value: C it has to be within of the temperature
+		LOOP,		// arg: counter, jump: pc, value: times to go back
+		ABOVE,		// value: C that aborts the run
+		TIMEOUT,	// value: s the stage may take before the run aborts
+	} OP_t;
+
+	typedef struct {
+		uint8_t op;
+		uint8_t arg;
+		uint16_t jump;
+		float value;
+	} Instr_t;
+
+	Program() : size(0) {}
+
+	void clear() { size = 0; }
+
+	// false when the program is full
+	bool emit(OP_t op, uint8_t arg = 0, uint16_t jump = 0, float value = 0);
+
+	Instr_t code[PROGRAM_SIZE];
+	uint16_t size;
+};
+
+// Steps a program, once per control tick and in bounded time: at most
+// PROGRAM_STEPS instructions, stopping at the first one that waits or has
+// something for the controller to do.
+class ProgramRunner {
+public:
+	typedef enum {
+		NONE,
+		ENTER,		// stage() is the new stage
+		REACHED,	// the stage target was reached
+		DONE,
+		ABORT,		// why() says which guard
+	} EVENT_t;
+
+	typedef struct {
+		float temperature;
+		float rate;
+		// zone temperatures, NULL without zones
+		const double * zones;
+		uint8_t zone_count;
+	} Inputs_t;
+
+	ProgramRunner();
+
+	void begin(const Program * program, unsigned long now);
+
+	EVENT_t step(unsigned long now, const Inputs_t& in);
+
+	bool running() const { return _program != NULL; }
+	uint8_t stage() const { return _stage; }
+	uint16_t pc() const { return _pc; }
+	const char * why() const { return _why; }
+
+private:
+	const Program * _program;
+	uint16_t _pc;
+	// when the current instruction started, and the stage
+	unsigned long _mark;
+	unsigned long _stage_mark;
+	uint8_t _stage;
+	float _direction;
+	uint8_t _counters[PROGRAM_COUNTERS];
+	// guards, NAN or 0 when not set
+	float _above;
+	float _timeout;
+	const char * _why;
+
+	void next(unsigned long now) { _pc++; _mark = now; }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "RangeQuery.h"
+#include <memory>
+
+RangeQuery::RangeQuery(ControllerBase * controller, float interval, float from, float to, float step) :
+	_controller(controller),
+	_interval(interval),
+	_from(max(from, 0.0f)),
+	_to(to),
+	_step(max(step, interval)),
+	_next(0),
+	_header(false),
+	_first(true) {
+}
+
+bool RangeQuery::bucket(size_t i, Bucket_t& b) {
+	Readings& readings = _controller->readings();
+	float start = _from + i * _step;
+	if (start > _to)
+		return false;
+
+	// readings are _interval seconds apart, starting at 0 with the run
+	unsigned long run = readings.run_seq();
+	unsigned long size = readings.last_seq() + 1 - run;
+	size_t first = (size_t)ceilf(start / _interval);
+	size_t last = (size_t)ceilf(min(start + _step, _to + _interval / 2) / _interval);
+
+	b.min = INFINITY;
+	b.max = -INFINITY;
+	b.sum = 0;
+	b.count = 0;
+
+	ControllerBase::Temperature_t chunk[RANGE_CHUNK];
+	unsigned long seq = run + first;
+	while (seq < run + last) {
+		size_t n = readings.copy(seq, chunk, min(RANGE_CHUNK, run + last - seq));
+		if (!n)
+			break;
+		for (size_t r = 0; r < n; r++) {
+			float t = _controller->log_to_temperature(chunk[r]);
+			b.min = min(b.min, t);
+			b.max = max(b.max, t);
+			b.sum += t;
+			b.count++;
+		}
+		seq += n;
+	}
+	// a new run ends the query
+	return first < size && readings.run_seq() == run;
+}
+
+size_t RangeQuery::write(char * buffer, size_t maxLen, size_t index) {
+	// the rest of a piece that didn't fit the last chunk goes first
+	size_t len = _line.drain(buffer, maxLen);
+	Bucket_t b;
+	while (_line.empty() && len < maxLen && _next != (size_t)-1) {
+		if (!_header) {
+			_line.printf("{\"from\": %.1f, \"to\": %.1f, \"step\": %.1f, \"columns\": [\"time\", \"min\", \"max\", \"avg\", \"count\"], \"buckets\": [",
+				_from, _to, _step);
+			_header = true;
+		} else if (!bucket(_next, b)) {
+			_line.printf("]}");
+			_next = (size_t)-1;
+		} else {
+			if (b.count) {
+				_line.printf("%s[%.1f, %.2f, %.2f, %.2f, %u]",
+					_first ? "" : ", ", _from + _next * _step, b.min, b.max, b.sum / b.count, b.count);
+				_first = false;
+			}
+			_next++;
+		}
+		len += _line.drain(buffer + len, maxLen - len);
+	}
+	return Chunk<RANGE_LINE>::result(len, _next == (size_t)-1 && _line.empty());
+}
+
+AsyncWebServerResponse * RangeQuery::response(AsyncWebServerRequest * request) {
+	std::shared_ptr<RangeQuery> query(new RangeQuery(*this));
+	return request->beginChunkedResponse("application/json", [query](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+		return query->write((char *)buffer, maxLen, index);
+	});
+}
@@ -0,0 +1,42 @@
+#ifndef RANGE_QUERY_H
+#define RANGE_QUERY_H
+
+#include <ESPAsyncWebServer.h>
+#include "ControllerBase.h"
+#include "Chunk.h"
+
+// readings copied out of the controller at a time
+#define RANGE_CHUNK 32
+// the longest piece written at once, the header
+#define RANGE_LINE 160
+
+// Aggregates the controller readings into min/max/avg buckets of `step`
+// seconds between `from` and `to` and streams them as JSON.
+class RangeQuery {
+public:
+	typedef struct {
+		float min, max, sum;
+		uint16_t count;
+	} Bucket_t;
+
+	RangeQuery(ControllerBase * controller, float interval, float from, float to, float step);
+
+	AsyncWebServerResponse * response(AsyncWebServerRequest * request);
+
+	// aggregate bucket `i`, returns false once past the end of the range
+	bool bucket(size_t i, Bucket_t& b);
+
+private:
+	ControllerBase * _controller;
+	float _interval;
+	float _from, _to, _step;
+
+	size_t write(char * buffer, size_t maxLen, size_t index);
+
+	size_t _next;
+	bool _header;
+	Chunk<RANGE_LINE> _line;
+	bool _first;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "Readings.h"
+
+// how often copy() tries again when the controller got in the way
+#define READINGS_RETRIES 3
+
+Readings::Readings() :
+	_first(0),
+	_run(1),
+	_last(0) {
+	memset(_ring, 0, sizeof(_ring));
+}
+
+void Readings::start(Temperature_t t) {
+	unsigned long seq = _last + 1;
+	_ring[seq % READINGS_MAX] = t;
+	_first = t;
+	// readers in between see an empty run
+	__atomic_store_n(&_run, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&_last, seq, __ATOMIC_RELEASE);
+}
+
+void Readings::push(Temperature_t t) {
+	unsigned long seq = _last + 1;
+	_ring[seq % READINGS_MAX] = t;
+	__atomic_store_n(&_last, seq, __ATOMIC_RELEASE);
+}
+
+unsigned long Readings::first_seq() const {
+	unsigned long run = run_seq();
+	unsigned long last = last_seq();
+	return last + 1 >= run + READINGS_MAX ? last - READINGS_MAX + 2 : run;
+}
+
+size_t Readings::size() const {
+	unsigned long run = run_seq();
+	unsigned long last = last_seq();
+	if (last < run)
+		return 0;
+	return last - run + 1 < READINGS_MAX - 1 ? last - run + 1 : READINGS_MAX - 1;
+}
+
+size_t Readings::copy(unsigned long& from, Temperature_t * out, size_t n) const {
+	for (int tries = 0; tries < READINGS_RETRIES; tries++) {
+		unsigned long run = run_seq();
+		unsigned long last = last_seq();
+		if (last < run)
+			return 0;
+		// the slot after last is the one push() writes next, and it writes
+		// before it moves last on, so that one isn't counted as kept
+		unsigned long oldest = last + 1 >= run + READINGS_MAX ? last - READINGS_MAX + 2 : run;
+		unsigned long seq = from > oldest ? from : oldest;
+		if (seq > last)
+			return 0;
+		size_t count = last - seq + 1 < n ? last - seq + 1 : n;
+
+		for (size_t i = 0; i < count; i++)
+			out[i] = _ring[(seq + i) % READINGS_MAX];
+
+		// the run is the same and nothing we copied was overwritten
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (run_seq() == run && last_seq() + 1 < seq + READINGS_MAX) {
+			from = seq;
+			return count;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef READINGS_H
+#define READINGS_H
+
+#include <Arduino.h>
+
+// a power of two; at the default report interval of 10 s over 5 hours
+#define READINGS_MAX 2048
+
+// Reported temperatures, addressed by sequence number. Numbers keep going
+// up across runs; a run starts at run_seq(). The controller task appends,
+// any task can copy() from it without locks: the ring is never resized and
+// a copy checks afterwards that the controller didn't overwrite what it
+// read. Only the last READINGS_MAX - 1 readings of a run are kept.
+class Readings {
+public:
+	typedef float Temperature_t;
+
+	Readings();
+
+	// controller task
+	void start(Temperature_t t);
+	void push(Temperature_t t);
+
+	// any task
+	unsigned long run_seq() const { return __atomic_load_n(&_run, __ATOMIC_ACQUIRE); }
+	unsigned long last_seq() const { return __atomic_load_n(&_last, __ATOMIC_ACQUIRE); }
+	unsigned long first_seq() const;
+	size_t size() const;
+
+	// the first reading of the run, kept even when the ring moved past it
+	Temperature_t first() const { return _first; }
+	Temperature_t last() const { return _ring[last_seq() % READINGS_MAX]; }
+
+	// Copies up to n readings from sequence number `from` on (or the oldest
+	// kept, if that is gone) of the current run. Returns how many and the
+	// sequence number of the first one in `from`, 0 if there is nothing.
+	size_t copy(unsigned long& from, Temperature_t * out, size_t n) const;
+
+private:
+	Temperature_t _ring[READINGS_MAX];
+	Temperature_t _first;
+	unsigned long _run;
+	unsigned long _last;
+};
+
+#endif
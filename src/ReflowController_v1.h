@@ -3,6 +3,9 @@
 
 #include <ArduinoJson.h>
 #include "ControllerBase.h"
+#include "Coast.h"
+#include "Program.h"
+#include "Trace.h"
 
 class ReflowController : public ControllerBase
 {
@@ -10,34 +13,78 @@ class ReflowController : public ControllerBase
 	double _start_temperature;
 	Config::stages_iterator current_stage;
 	Config::profiles_iterator current_profile;
+	ProgramRunner _runner;
+
+	Coast _coast;
+	// furthest the temperature got in the stage's direction; the last
+	// stage is followed into cooling until the coast is over
+	float _peak;
+	bool _peak_pending;
+	Config::Name_t _peak_stage;
+	float _peak_target;
+	float _peak_direction;
 
 public:
 	ReflowController(Config& cfg) : ControllerBase(cfg)
 	{
 		_stage_start = 0;
-		current_profile = config.profiles.end();
+		current_profile = NULL;
+		_peak_pending = false;
 	}
 
 	virtual void handle_reflow(unsigned long now) {
-		if (current_profile == config.profiles.end()) {
+		TRACE_SCOPE("handle_reflow");
+		if (current_profile == NULL) {
 			callMessage("ERROR: No Profile in reflow mode!");
 			mode(ERROR_OFF);
 			return;
-		} else if (current_stage == current_profile->second.stages.end())
+		} else if (current_stage == current_profile->stages.end())
 			return;
 
 		float direction = current_stage->target >= _start_temperature ? 1 : -1;
-		if (direction * (temperature() - current_stage->target) > 0 && _stage_start == 0) {
-			_stage_start = now;
-			if (current_stage->rate <= 0)
-				target(current_stage->target);
-			resetPID();
-			callMessage("INFO: Stage reached, waiting for %f seconds...", current_stage->stay);
-		} else if (_stage_start != 0 && now - _stage_start > current_stage->stay * 1000) {
-			stage(++current_stage);
+
+		// the oven keeps climbing after the heater goes off; stop feeding it
+		// once that is enough to get to the stage target. With a board probe
+		// the outer loop sees to that.
+		if (!cascading() && direction > 0 && _stage_start == 0 && _coast.cut(temperature(), avg_rate(), current_stage->target)) {
+			limit_control(0);
+			_coast.start(temperature(), avg_rate());
 		}
 
+		if (run(now) == ProgramRunner::ABORT)
+			return;
+
 		handle_pid(now);
+		if (heater())
+			_coast.abort();
+	}
+
+	// one step of the profile's program, and what it asks for
+	ProgramRunner::EVENT_t run(unsigned long now) {
+		ProgramRunner::Inputs_t in = {(float)measured(), (float)measured_rate(), zones().temperature, zones().count()};
+		ProgramRunner::EVENT_t event = _runner.step(now, in);
+		switch (event) {
+			case ProgramRunner::ENTER:
+				stage(current_profile->stages.begin() + _runner.stage());
+				break;
+			case ProgramRunner::REACHED:
+				_stage_start = now;
+				if (current_stage->rate <= 0)
+					target(current_stage->target);
+				resetPID();
+				callMessage("INFO: Stage reached, waiting for %f seconds...", current_stage->stay);
+				break;
+			case ProgramRunner::DONE:
+				stage(current_profile->stages.end());
+				break;
+			case ProgramRunner::ABORT:
+				callMessage("ERROR: Profile '%s' aborted in stage '%s', %s!", current_profile->name.c_str(), current_stage->name.c_str(), _runner.why());
+				mode(ERROR_OFF);
+				break;
+			case ProgramRunner::NONE:
+				break;
+		}
+		return event;
 	}
 
 	virtual const char * name() { return "Reflow Controller v1.0"; }
@@ -45,12 +92,29 @@ public:
 	virtual void handle_measure(unsigned long now) {
 		ControllerBase::handle_measure(now);
 		if (ControllerBase::mode() == REFLOW) {
-			handle_target(avg_rate());
+			handle_target(measured_rate());
 		}
+
+		if (_coast.update(temperature(), avg_rate()))
+			callMessage("INFO: Coasted %.1f*C after the heater went off, coast model now %.1f s",
+				_coast.rise(), _coast.gain());
+
+		if (ControllerBase::mode() == REFLOW || _peak_pending) {
+			_peak = _peak_direction > 0 ? max(_peak, (float)measured()) : min(_peak, (float)measured());
+			if (_peak_pending && _peak_direction * measured_rate() <= 0) {
+				_peak_pending = false;
+				report_peak();
+			}
+		}
+	}
+
+	void report_peak() {
+		callMessage("INFO: Stage '%s' peak %.1f*C, %+.1f*C off its target of %.1f*C",
+			_peak_stage.c_str(), _peak, _peak - _peak_target, _peak_target);
 	}
 
 	virtual void interpolate_target(float direction) {
-		float next_temperature = target() + direction * current_stage->rate * config.measureInterval / 1000.0;
+		float next_temperature = target() + direction * current_stage->rate * sample_dt() / 1000.0;
 		float target_cap = current_stage->target;
 		float T = direction > 0 ? min(next_temperature, target_cap) : max(next_temperature, target_cap);
 		//callMessage("DEBUG: target: d=%f     t=%f    T=%f", direction, next_temperature, T);
@@ -58,18 +122,18 @@ public:
 		//resetPID();
 	}
 	virtual void handle_target(float current_rate) {
-		if (current_profile != config.profiles.end()										// profile set
-				&& current_stage != current_profile->second.stages.end()		// stage set
+		if (current_profile != NULL										// profile set
+				&& current_stage != current_profile->stages.end()		// stage set
 				&& current_stage->rate > 0																	// rate set
 				&& abs(current_rate) <= current_stage->rate) {							// current average rate is within limits
 
 			float direction = target() <= current_stage->target ? 1 : -1;
 
-			if (direction * (temperature() - current_stage->target) < 0						// haven't reached stage target yet
-					&& (direction * (temperature() - target()) > 0 || abs(current_rate) < current_stage->rate)) {										// reached interpolated target
+			if (direction * (measured() - current_stage->target) < 0						// haven't reached stage target yet
+					&& (direction * (measured() - target()) > 0 || abs(current_rate) < current_stage->rate)) {										// reached interpolated target
 				interpolate_target(direction);
-			} /* else if (current_profile != config.profiles.end()
-					&& current_stage != current_profile->second.stages.end()
+			} /* else if (current_profile != NULL
+					&& current_stage != current_profile->stages.end()
 					&& current_stage->rate > 0
 					&& abs(current_rate) > current_stage->rate) {
 					TODO: override _current_control
@@ -82,61 +146,87 @@ public:
 	// * profile check
 	// * load profile on reflow start
 	virtual MODE_t mode(MODE_t m) {
-		if (m != REFLOW) {
+		// a latched fault refuses the run before any of it starts
+		if (m != REFLOW || faults().active()) {
 			return ControllerBase::mode(m);
 		}
 
-		if (current_profile != config.profiles.end()) {
-			stage(current_profile->second.stages.begin());
+		if (current_profile != NULL) {
+			_peak_pending = false;
+			// the first step enters the first stage
+			_runner.begin(&current_profile->program, millis());
+			if (run(millis()) == ProgramRunner::ABORT)
+				return ControllerBase::mode();
 			return ControllerBase::mode(m);
 		}
 		return ControllerBase::mode(OFF);
 	}
 
-	virtual const String& profile(const String& name) {
+	virtual const char * profile(const char * name) {
 		Config::profiles_iterator p = config.profiles.find(name);
 		if (p != config.profiles.end()) {
-			if (p->second.stages.begin() == p->second.stages.end()) {
-				callMessage("ERROR: Profile '%s' has no stages!", name.c_str());
+			if (p->stages.begin() == p->stages.end()) {
+				callMessage("ERROR: Profile '%s' has no stages!", name);
 				return ControllerBase::profile();
 			}
 			mode(OFF);
 			current_profile = p;
-			current_stage = p->second.stages.begin();
+			current_stage = p->stages.begin();
+			_retune = p->retune;
 			stage(current_stage);
-			callMessage("INFO: Profile set to '%s'", current_profile->second.name.c_str());
+			callMessage("INFO: Profile set to '%s'", current_profile->name.c_str());
 			return ControllerBase::profile(name);
 		} else {
 			mode(ERROR_OFF);
-			callMessage("ERROR: No such profile '%s' found!", name.c_str());
+			callMessage("ERROR: No such profile '%s' found!", name);
 			return ControllerBase::profile();
 		}
 	}
 
-	virtual const String& profile() {
-		if (current_profile != config.profiles.end())
-			return current_profile->second.name;
+	virtual void reload_profiles() {
+		// selected again by name, or not at all if it is gone
+		current_profile = NULL;
+		ControllerBase::reload_profiles();
+	}
+
+	virtual const char * profile() {
+		if (current_profile != NULL)
+			return current_profile->name.c_str();
 		else
 			return ControllerBase::profile();
 	}
 
-	virtual const String& stage() {
-		if (current_profile != config.profiles.end()) {
-			return current_stage->name;
+	virtual const char * stage() {
+		// past the last stage once the run is done
+		if (current_profile != NULL && current_stage != current_profile->stages.end()) {
+			return current_stage->name.c_str();
 		} else
 			return ControllerBase::stage();
 	}
 
-	virtual const String& stage(Config::stages_iterator stage) {
+	virtual const char * stage(Config::stages_iterator stage) {
 		Config::stages_iterator last_stage = current_stage;
 		current_stage = stage;
 
-		if (current_stage != last_stage)
+		if (current_stage != last_stage) {
 			callMessage("INFO: Stage '%s' finished.", last_stage->name.c_str());
-		if (stage != current_profile->second.stages.end()) {
+			// the last stage still coasts, its peak is reported once cooling
+			if (ControllerBase::mode() == REFLOW) {
+				if (stage != current_profile->stages.end())
+					report_peak();
+				else
+					_peak_pending = true;
+			}
+		}
+		if (stage != current_profile->stages.end()) {
 			setPID(stage->pid);
 			_stage_start = 0;
-			_start_temperature = measure_temperature(millis());
+			measure_temperature(millis());
+			_start_temperature = measured();
+			_peak = _start_temperature;
+			_peak_stage = stage->name;
+			_peak_target = stage->target;
+			_peak_direction = stage->target >= _start_temperature ? 1 : -1;
 			if (stage->rate > 0) {
 				if (last_stage == current_stage) {
 					target(_start_temperature);
@@ -145,12 +235,17 @@ public:
 			} else {
 				target(stage->target);
 			}
+			float offsets[ZONES_MAX];
+			for (int z = 0; z < ZONES_MAX; z++)
+				offsets[z] = isnan(stage->zones[z]) ? 0 : stage->zones[z] - stage->target;
+			zone_offsets(offsets);
 			if (_onStage)
 				_onStage(stage->name.c_str(), (float)stage->target);
 			return ControllerBase::stage(stage->name);
 		} else {
 			mode(REFLOW_COOL);
 			target(20);
+			zone_offsets(NULL);
 			if (_onStage)
 				_onStage("DONE", target());
 			return ControllerBase::stage();
@@ -0,0 +1,201 @@
+#include "RunArchive.h"
+#include "Chunk.h"
+#include <memory>
+
+RunArchive::RunArchive() :
+	_last_id(0),
+	_running(false),
+	_dropped(0),
+	_queue(NULL) {
+	memset(_index, 0, sizeof(_index));
+}
+
+bool RunArchive::begin() {
+	File f = SPIFFS.open(ARCHIVE_INDEX, "r");
+	if (f) {
+		f.read((uint8_t *)_index, sizeof(_index));
+		f.close();
+	}
+	for (int i = 0; i < ARCHIVE_RUNS; i++)
+		if (_index[i].id > _last_id)
+			_last_id = _index[i].id;
+
+	_queue = xQueueCreate(ARCHIVE_QUEUE, sizeof(Msg_t));
+	if (!_queue)
+		return false;
+	return xTaskCreate(RunArchive::task, "archive", 4096, this, 1, NULL) == pdPASS;
+}
+
+String RunArchive::path(uint32_t id) {
+	return "/runs/" + String(id % ARCHIVE_RUNS) + ".bin";
+}
+
+void RunArchive::post(MSG_t type) {
+	_batch.type = type;
+	if (type == CLOSE || type == OPEN)
+		_batch.index = _current;
+	if (!_queue || xQueueSend(_queue, &_batch, 0) != pdTRUE)
+		_dropped++;
+	_batch.count = 0;
+}
+
+void RunArchive::start(const char * profile, int mode) {
+	if (_running)
+		finish(ABORTED);
+
+	memset(&_current, 0, sizeof(_current));
+	_current.id = ++_last_id;
+	strncpy(_current.profile, profile, sizeof(_current.profile) - 1);
+	_current.start = time(NULL);
+	_current.peak = INT16_MIN;
+	_current.mode = mode;
+	_current.result = RUNNING;
+	_index[_current.id % ARCHIVE_RUNS] = _current;
+	_running = true;
+
+	post(OPEN);
+}
+
+void RunArchive::append(unsigned long elapsed, float temperature, float target) {
+	if (!_running)
+		return;
+
+	Sample_t& s = _batch.samples[_batch.count++];
+	s.elapsed = elapsed;
+	s.temperature = isnan(temperature) ? INT16_MIN : (int16_t)(temperature * 10);
+	s.target = (int16_t)(target * 10);
+	if (s.temperature > _current.peak)
+		_current.peak = s.temperature;
+	_current.samples++;
+
+	if (_batch.count == ARCHIVE_BATCH)
+		post(DATA);
+}
+
+void RunArchive::finish(RESULT_t result) {
+	if (!_running)
+		return;
+
+	if (_batch.count)
+		post(DATA);
+	_current.result = result;
+	_index[_current.id % ARCHIVE_RUNS] = _current;
+	_running = false;
+
+	post(CLOSE);
+}
+
+void RunArchive::write_index(const Index_t& index) {
+	File f = SPIFFS.open(ARCHIVE_INDEX, "r+");
+	if (!f) {
+		Index_t empty[ARCHIVE_RUNS];
+		memset(empty, 0, sizeof(empty));
+		f = SPIFFS.open(ARCHIVE_INDEX, "w");
+		if (!f)
+			return;
+		f.write((uint8_t *)empty, sizeof(empty));
+	}
+	f.seek((index.id % ARCHIVE_RUNS) * sizeof(Index_t), SeekSet);
+	f.write((uint8_t *)&index, sizeof(Index_t));
+	f.close();
+}
+
+void RunArchive::task(void * arg) {
+	RunArchive * self = (RunArchive *)arg;
+	static Msg_t msg;
+	File f;
+
+	for (;;) {
+		if (xQueueReceive(self->_queue, &msg, portMAX_DELAY) != pdTRUE)
+			continue;
+
+		switch (msg.type) {
+			case OPEN:
+				// the slot is reused, mark it as in progress before truncating
+				write_index(msg.index);
+				f = SPIFFS.open(path(msg.index.id), "w");
+				break;
+			case DATA:
+				if (f)
+					f.write((uint8_t *)msg.samples, msg.count * sizeof(Sample_t));
+				break;
+			case CLOSE:
+				if (f)
+					f.close();
+				write_index(msg.index);
+				break;
+		}
+	}
+}
+
+const char * RunArchive::translate(RESULT_t result) {
+	switch (result) {
+		case COMPLETE: return "complete";
+		case ABORTED: return "aborted";
+		case FAULT: return "fault";
+		case RUNNING: return "running";
+	}
+	return "unknown";
+}
+
+String RunArchive::toJSON() {
+	char str[160] = "";
+	String json = "{\"runs\": [";
+	bool first = true;
+	// newest first
+	for (uint32_t id = _last_id; id > 0 && id + ARCHIVE_RUNS > _last_id; id--) {
+		Index_t& r = _index[id % ARCHIVE_RUNS];
+		if (r.id != id)
+			continue;
+		sprintf(str, "%s{\"id\": %u, \"profile\": \"%s\", \"start\": %u, \"samples\": %u, \"peak\": %.1f, \"mode\": %d, \"result\": \"%s\"}",
+			first ? "" : ", ", r.id, r.profile, r.start, r.samples, r.peak / 10.0, r.mode, translate((RESULT_t)r.result));
+		json += str;
+		first = false;
+	}
+	sprintf(str, "], \"dropped\": %u}", _dropped);
+	json += str;
+	return json;
+}
+
+AsyncWebServerResponse * RunArchive::download(AsyncWebServerRequest * request, uint32_t id, bool csv) {
+	if (id == 0 || _index[id % ARCHIVE_RUNS].id != id)
+		return NULL;
+
+	File f = SPIFFS.open(path(id), "r");
+	if (!f)
+		return NULL;
+
+	if (!csv)
+		return request->beginChunkedResponse("application/octet-stream", [f](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+			return f.read(buffer, maxLen);
+		});
+
+	typedef struct {
+		File f;
+		bool header;
+		Chunk<48> line;
+	} Csv_t;
+	std::shared_ptr<Csv_t> c(new Csv_t());
+	c->f = f;
+	c->header = false;
+	return request->beginChunkedResponse("text/csv", [c](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+		char * out = (char *)buffer;
+		// the rest of a line that didn't fit the last chunk goes first
+		size_t len = c->line.drain(out, maxLen);
+		bool done = false;
+		Sample_t s;
+		while (c->line.empty() && len < maxLen) {
+			if (!c->header) {
+				c->line.printf("Time,Temperature,Target\n");
+				c->header = true;
+			} else if (c->f.read((uint8_t *)&s, sizeof(s)) == sizeof(s)) {
+				c->line.printf("%.1f,%.1f,%.1f\n", s.elapsed / 1000.0, s.temperature / 10.0, s.target / 10.0);
+			} else {
+				done = true;
+				break;
+			}
+			len += c->line.drain(out + len, maxLen - len);
+		}
+		return Chunk<48>::result(len, done);
+	});
+}
@@ -0,0 +1,96 @@
+#ifndef RUN_ARCHIVE_H
+#define RUN_ARCHIVE_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+#include <SPIFFS.h>
+#include <time.h>
+
+#define ARCHIVE_RUNS 16
+#define ARCHIVE_BATCH 32
+#define ARCHIVE_QUEUE 4
+#define ARCHIVE_INDEX "/runs/index"
+
+// Keeps a record of the last ARCHIVE_RUNS runs on SPIFFS. Samples are
+// collected in RAM and handed in batches to a low priority writer task, so
+// the control loop never waits for flash.
+class RunArchive {
+public:
+	typedef enum {
+		COMPLETE = 0,
+		ABORTED = 1,
+		FAULT = 2,
+		RUNNING = 3,
+	} RESULT_t;
+
+	typedef struct __attribute__((packed)) {
+		uint32_t elapsed;		// ms since the start of the run
+		int16_t temperature;	// 1/10 *C
+		int16_t target;			// 1/10 *C
+	} Sample_t;
+
+	typedef struct {
+		uint32_t id;			// run number, 0 for an empty slot
+		char profile[24];
+		uint32_t start;			// time(), seconds since boot unless the clock is set
+		uint32_t samples;
+		int16_t peak;			// 1/10 *C
+		int8_t mode;
+		uint8_t result;
+	} Index_t;
+
+	RunArchive();
+
+	bool begin();
+
+	void start(const char * profile, int mode);
+
+	void append(unsigned long elapsed, float temperature, float target);
+
+	void finish(RESULT_t result);
+
+	bool running() { return _running; }
+
+	static const char * translate(RESULT_t result);
+
+	String toJSON();
+
+	AsyncWebServerResponse * download(AsyncWebServerRequest * request, uint32_t id, bool csv);
+
+private:
+	typedef enum {
+		OPEN,
+		DATA,
+		CLOSE,
+	} MSG_t;
+
+	typedef struct {
+		uint8_t type;
+		uint8_t count;
+		union {
+			Sample_t samples[ARCHIVE_BATCH];
+			Index_t index;
+		};
+	} Msg_t;
+
+	Index_t _index[ARCHIVE_RUNS];
+	uint32_t _last_id;
+	bool _running;
+
+	Index_t _current;
+	Msg_t _batch;
+	uint32_t _dropped;
+
+	QueueHandle_t _queue;
+
+	void post(MSG_t type);
+
+	static String path(uint32_t id);
+
+	static void write_index(const Index_t& index);
+
+	static void task(void * arg);
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include "Sampler.h"
+
+Sampler::Sampler() :
+	_base(1000),
+	_max(1000),
+	_interval(1000) {
+}
+
+void Sampler::begin(unsigned long base) {
+	_base = base > SAMPLE_MIN ? base : SAMPLE_MIN;
+	_max = _base * SAMPLE_MAX_FACTOR;
+	_interval = _base;
+}
+
+unsigned long Sampler::next(float rate) {
+	float speed = fabs(rate);
+	unsigned long wanted = speed > 0 ? (unsigned long)(1000.0 * SAMPLE_RESOLUTION / speed) : _max;
+	if (wanted < SAMPLE_MIN)
+		wanted = SAMPLE_MIN;
+	if (wanted > _max)
+		wanted = _max;
+
+	unsigned long slowest = _interval * SAMPLE_SLOWDOWN;
+	_interval = wanted < slowest ? wanted : slowest;
+	return _interval;
+}
+
+unsigned long Sampler::fixed() {
+	_interval = _base;
+	return _interval;
+}
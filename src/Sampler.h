@@ -0,0 +1,40 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <Arduino.h>
+
+// the MAX31855 needs up to 100 ms for a conversion
+#define SAMPLE_MIN 100
+// slowest sampling, in multiples of config.measureInterval
+#define SAMPLE_MAX_FACTOR 4
+// temperature change we want to see between two samples, in C
+#define SAMPLE_RESOLUTION 0.5
+// how much slower each sample may get, faster is taken right away
+#define SAMPLE_SLOWDOWN 1.25
+
+// Picks the measure interval from how fast the temperature moves: quick
+// on steep ramps, down to the thermocouple's conversion time, slow during
+// soaks and holds. Speeding up happens at once, slowing down gradually so
+// a short flat spot in a ramp doesn't drop the rate.
+class Sampler {
+public:
+	Sampler();
+
+	void begin(unsigned long base);
+
+	// interval in ms after a sample with the estimated rate in C/s
+	unsigned long next(float rate);
+
+	// back to the configured interval, e.g. for the auto tuner which
+	// expects a fixed one
+	unsigned long fixed();
+
+	unsigned long interval() const { return _interval; }
+
+private:
+	unsigned long _base;
+	unsigned long _max;
+	unsigned long _interval;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <Arduino.h>
+
+// One writer publishes a copy of T, any number of readers take consistent
+// copies without locks. The writer never waits; a reader that overlapped a
+// write tries again. T must be plain data.
+//
+// The write itself is a critical section only so a reader of higher
+// priority can't preempt it on the same core and then spin forever; no
+// reader ever takes the lock.
+template<typename T>
+class Seqlock {
+public:
+	Seqlock() : _seq(0) {
+		portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+		_mux = mux;
+	}
+
+	void write(const T& value) {
+		portENTER_CRITICAL(&_mux);
+		uint32_t seq = _seq;
+		__atomic_store_n(&_seq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy((void *)&_value, &value, sizeof(T));
+		__atomic_store_n(&_seq, seq + 2, __ATOMIC_RELEASE);
+		portEXIT_CRITICAL(&_mux);
+	}
+
+	void read(T& value) const {
+		for (;;) {
+			uint32_t seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+			if (seq & 1)
+				continue;
+			memcpy(&value, (const void *)&_value, sizeof(T));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&_seq, __ATOMIC_RELAXED) == seq)
+				return;
+		}
+	}
+
+	uint32_t version() const { return __atomic_load_n(&_seq, __ATOMIC_ACQUIRE) / 2; }
+
+private:
+	portMUX_TYPE _mux;
+	uint32_t _seq;
+	T _value;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "Smith.h"
+
+Smith::Smith() :
+	_gain(0), _tau(0), _dead(0),
+	_step(SMITH_STEP_MIN),
+	_delay(0),
+	_head(0),
+	_x(0),
+	_control(0),
+	_last(0),
+	_last_push(0) {
+	fill();
+}
+
+void Smith::begin(float gain, float tau, float dead, float temperature) {
+	if (gain == _gain && tau == _tau && dead == _dead)
+		return;
+	_gain = gain;
+	_tau = tau;
+	_dead = max(dead, 0.0f);
+	// as fine as the slots allow for the whole dead time
+	unsigned long dead_ms = _dead * 1000;
+	_step = max((unsigned long)SMITH_STEP_MIN, (dead_ms + SMITH_SLOTS - 2) / (SMITH_SLOTS - 1));
+	_delay = min(dead_ms / _step, (unsigned long)SMITH_SLOTS - 1);
+	// a new model predicts nothing yet; the old model's state says nothing
+	// about where this one is
+	_x = temperature - SMITH_AMBIENT;
+	fill();
+}
+
+void Smith::reset(unsigned long now, float temperature) {
+	_x = temperature - SMITH_AMBIENT;
+	_control = 0;
+	_last = _last_push = now;
+	fill();
+}
+
+void Smith::fill() {
+	for (int i = 0; i < SMITH_SLOTS; i++)
+		_line[i] = _x;
+	_head = 0;
+}
+
+void Smith::integrate(unsigned long to) {
+	if (_tau <= 0 || to == _last)
+		return;
+	float dt = (to - _last) / 1000.0;
+	_x += (_gain * _control - _x) * (1 - exp(-dt / _tau));
+	_last = to;
+}
+
+void Smith::advance(unsigned long now) {
+	if (!active()) {
+		_last = _last_push = now;
+		return;
+	}
+	// after a long gap the whole line is the same anyway
+	if (now - _last_push > SMITH_SLOTS * _step) {
+		integrate(now);
+		fill();
+		_last_push = now;
+	}
+	while (now - _last_push >= _step) {
+		_last_push += _step;
+		integrate(_last_push);
+		_line[_head] = _x;
+		_head = (_head + 1) % SMITH_SLOTS;
+	}
+	integrate(now);
+}
+
+float Smith::correction() const {
+	if (!active() || _delay == 0)
+		return 0;
+	// the newest slot is _head - 1
+	return _x - _line[(_head + SMITH_SLOTS - 1 - _delay) % SMITH_SLOTS];
+}
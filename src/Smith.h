@@ -0,0 +1,56 @@
+#ifndef SMITH_H
+#define SMITH_H
+
+#include <Arduino.h>
+
+// delay line slots, and the finest step they are spaced at in ms
+#define SMITH_SLOTS 64
+#define SMITH_STEP_MIN 100
+#define SMITH_AMBIENT 25.0
+
+// Smith predictor: a first order model of the plant run twice, with and
+// without its dead time. The PID sees the measurement plus the difference,
+// i.e. where the temperature is already headed but doesn't show yet, so it
+// can be tuned as if the plant had no dead time. The delayed model is a
+// fixed delay line whose slots are spaced so the dead time fits.
+class Smith {
+public:
+	Smith();
+
+	// a model to predict with, none with tau <= 0; the prediction carries
+	// on if the model stays the same, a new one starts from the plant at
+	// this temperature
+	void begin(float gain, float tau, float dead, float temperature);
+
+	bool active() const { return _tau > 0; }
+
+	// a plant at rest at this temperature
+	void reset(unsigned long now, float temperature);
+
+	// runs the model up to now with the duty applied since apply(), before
+	// the PID computes
+	void advance(unsigned long now);
+
+	// the duty the heater gets from now on, once it is final
+	void apply(float control) { _control = control; }
+
+	// the rise the measurement hasn't shown yet, in C
+	float correction() const;
+
+private:
+	float _gain, _tau, _dead;
+	unsigned long _step;
+	uint8_t _delay;
+
+	float _line[SMITH_SLOTS];
+	uint8_t _head;
+	float _x;
+	float _control;
+	unsigned long _last;
+	unsigned long _last_push;
+
+	void integrate(unsigned long to);
+	void fill();
+};
+
+#endif
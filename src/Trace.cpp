@@ -0,0 +1,64 @@
+#include "Trace.h"
+#include "Chunk.h"
+#include <memory>
+
+Trace trace;
+
+Trace::Trace() :
+	_head(0) {
+	memset(_events, 0, sizeof(_events));
+}
+
+TraceScope::~TraceScope() {
+	trace.complete(_name, _ts, ESP.getCycleCount() - _start);
+}
+
+AsyncWebServerResponse * Trace::response(AsyncWebServerRequest * request) {
+	// dump what is in the ring right now, oldest first. The ring keeps
+	// being written while it goes out; events overwritten by then are
+	// skipped, what is dumped is never torn
+	typedef struct {
+		uint32_t next;
+		uint32_t head;
+		bool first;
+		bool done;
+		Chunk<TRACE_LINE> line;
+	} Dump_t;
+	std::shared_ptr<Dump_t> d(new Dump_t());
+	d->head = _head;
+	d->next = d->head > TRACE_EVENTS ? d->head - TRACE_EVENTS : 0;
+	d->first = true;
+	d->done = false;
+	float mhz = ESP.getCpuFreqMHz();
+
+	d->line.printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	return request->beginChunkedResponse("application/json", [this, d, mhz](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+		char * out = (char *)buffer;
+		// the rest of an event that didn't fit the last chunk goes first
+		size_t len = d->line.drain(out, maxLen);
+		while (d->line.empty() && len < maxLen && !d->done) {
+			if (d->next == d->head) {
+				d->line.printf("\n]}\n");
+				d->done = true;
+			} else {
+				Event_t e = _events[d->next % TRACE_EVENTS];
+				// the slot is reused once the writers are a ring ahead of it
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				bool overwritten = _head - d->next >= TRACE_EVENTS;
+				d->next++;
+				if (overwritten)
+					continue;
+				const char * sep = d->first ? "\n" : ",\n";
+				d->first = false;
+				if (e.ph == 'X')
+					d->line.printf("%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %u, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}",
+						sep, e.name, e.ts, e.cycles / mhz, e.core);
+				else
+					d->line.printf("%s{\"name\": \"%s\", \"ph\": \"C\", \"ts\": %u, \"pid\": 1, \"args\": {\"%s\": %d}}",
+						sep, e.name, e.ts, e.name, e.value);
+			}
+			len += d->line.drain(out + len, maxLen - len);
+		}
+		return Chunk<TRACE_LINE>::result(len, d->done && d->line.empty());
+	});
+}
@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <esp_timer.h>
+
+#define TRACE_EVENTS 512
+// the longest event in the dump
+#define TRACE_LINE 192
+
+// Fixed ring of trace events, dumped as Chrome trace JSON for
+// chrome://tracing or Perfetto. Durations are taken from the CPU cycle
+// counter, timestamps from esp_timer.
+class Trace {
+public:
+	typedef struct {
+		const char * name;		// string literal
+		uint32_t ts;			// us since boot
+		uint32_t cycles;		// duration, 0 for counters
+		int16_t value;			// counter value
+		uint8_t core;
+		char ph;				// 'X' complete, 'C' counter
+	} Event_t;
+
+	Trace();
+
+	void complete(const char * name, uint32_t ts, uint32_t cycles) {
+		Event_t& e = next();
+		e.name = name;
+		e.ts = ts;
+		e.cycles = cycles;
+		e.value = 0;
+		e.core = xPortGetCoreID();
+		e.ph = 'X';
+	}
+
+	void counter(const char * name, int16_t value) {
+		Event_t& e = next();
+		e.name = name;
+		e.ts = esp_timer_get_time();
+		e.cycles = 0;
+		e.value = value;
+		e.core = xPortGetCoreID();
+		e.ph = 'C';
+	}
+
+	void clear() { _head = 0; }
+
+	AsyncWebServerResponse * response(AsyncWebServerRequest * request);
+
+private:
+	Event_t _events[TRACE_EVENTS];
+	volatile uint32_t _head;
+
+	Event_t& next() {
+		return _events[__atomic_fetch_add(&_head, 1, __ATOMIC_RELAXED) % TRACE_EVENTS];
+	}
+};
+
+class TraceScope {
+public:
+	TraceScope(const char * name) : _name(name), _ts(esp_timer_get_time()), _start(ESP.getCycleCount()) {}
+	~TraceScope();
+private:
+	const char * _name;
+	uint32_t _ts;
+	uint32_t _start;
+};
+
+extern Trace trace;
+
+#define TRACE_SCOPE(name) TraceScope _trace_scope(name)
+
+#endif
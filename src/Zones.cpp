@@ -0,0 +1,151 @@
+#include "Zones.h"
+#include "ControllerBase.h"
+
+Zones::Zones(Config& cfg) :
+	config(cfg),
+	_count(0),
+	_history_head(0),
+	_history_len(0) {
+	memset(sensor, 0, sizeof(sensor));
+	memset(pid, 0, sizeof(pid));
+}
+
+Zones::~Zones() {
+	for (uint8_t z = 0; z < ZONES_MAX; z++) {
+		delete sensor[z];
+		delete pid[z];
+	}
+}
+
+void Zones::begin(uint8_t clk, uint8_t data) {
+	_count = config.zone_count;
+	for (uint8_t z = 0; z < _count; z++) {
+		temperature[z] = 0;
+		target[z] = DEFAULT_TARGET;
+		control[z] = 0;
+		duty[z] = 0;
+		offset[z] = 0;
+		heater[z] = false;
+		last_off[z] = 0;
+		relay[z] = config.zones[z].relay;
+
+		delete sensor[z];
+		delete pid[z];
+		sensor[z] = new MAX31855(clk, config.zones[z].cs, data);
+		sensor[z]->begin();
+		pid[z] = new PID(&temperature[z], &control[z], &target[z], 0, 0, 0, DIRECT);
+		pid[z]->SetSampleTime(SAMPLE_MIN * 1000);
+		pid[z]->SetMode(AUTOMATIC);
+		pid[z]->SetOutputLimits(0, 1);
+
+		pinMode(relay[z], OUTPUT);
+		digitalWrite(relay[z], LOW);
+		S_printf("Zone %s: cs=%d relay=%d", name(z), config.zones[z].cs, relay[z]);
+	}
+}
+
+void Zones::tune(double P, double I, double D) {
+	for (uint8_t z = 0; z < _count; z++)
+		pid[z]->Retune(P, I, D);
+}
+
+void Zones::reset() {
+	for (uint8_t z = 0; z < _count; z++)
+		pid[z]->Reset();
+	_history_head = _history_len = 0;
+}
+
+void Zones::offsets(const float * offsets) {
+	for (uint8_t z = 0; z < _count; z++)
+		offset[z] = offsets ? offsets[z] : 0;
+}
+
+void Zones::measure(unsigned long now) {
+	for (uint8_t z = 0; z < _count; z++) {
+		sensor[z]->read();
+		temperature[z] = sensor[z]->getTemperature();
+	}
+}
+
+void Zones::compute(unsigned long now, double t) {
+	for (uint8_t z = 0; z < _count; z++)
+		target[z] = t + offset[z];
+	for (uint8_t z = 0; z < _count; z++) {
+		pid[z]->Compute(now * 1000);
+		control[z] = max(control[z], 0.0);
+	}
+}
+
+void Zones::log() {
+	for (uint8_t z = 0; z < _count; z++)
+		history[z][_history_head] = temperature[z];
+	_history_head = (_history_head + 1) % ZONE_HISTORY;
+	if (_history_len < ZONE_HISTORY)
+		_history_len++;
+}
+
+void Zones::latch() {
+	for (uint8_t z = 0; z < _count; z++)
+		duty[z] = control[z];
+}
+
+void Zones::drive(DRIVE_t how, unsigned long phase, float window) {
+	for (uint8_t z = 0; z < _count; z++) {
+		switch (how) {
+			case ALL_OFF: heater[z] = false; break;
+			case ALL_ON: heater[z] = true; break;
+			case CONTROL:
+				// same time proportioning as ControllerBase::handle_pid()
+				heater[z] = (phase < window * duty[z] && duty[z] > CONTROL_HYSTERISIS) ||
+					(phase >= window * duty[z] && duty[z] > 1.0 - CONTROL_HYSTERISIS);
+				break;
+		}
+	}
+}
+
+void Zones::write() {
+	for (uint8_t z = 0; z < _count; z++)
+		digitalWrite(relay[z], heater[z]);
+}
+
+int Zones::check(unsigned long now, Faults::FAULT_t& fault) {
+	for (uint8_t z = 0; z < _count; z++) {
+		if (!heater[z]) {
+			last_off[z] = now;
+			continue;
+		}
+		if (isnan(temperature[z]))
+			fault = Faults::PROBE;
+		else if (temperature[z] > MAX_TEMPERATURE)
+			fault = Faults::OVER_TEMPERATURE;
+		else if (now - last_off[z] > MAX_ON_TIME && temperature[z] > SAFE_TEMPERATURE)
+			fault = Faults::HEATER_TIME;
+		else
+			continue;
+		return z;
+	}
+	return -1;
+}
+
+String Zones::toJSON(bool with_history) {
+	char str[128] = "";
+	String json = "{\"zones\": [";
+	for (uint8_t z = 0; z < _count; z++) {
+		sprintf(str, "%s{\"name\": \"%s\", \"temperature\": %.2f, \"target\": %.2f, \"control\": %.3f, \"heater\": %s",
+			z ? ", " : "", name(z), temperature[z], target[z], control[z], heater[z] ? "true" : "false");
+		json += str;
+		if (with_history) {
+			json += ", \"history\": [";
+			// oldest first
+			for (uint16_t i = 0; i < _history_len; i++) {
+				uint16_t h = (_history_head + ZONE_HISTORY - _history_len + i) % ZONE_HISTORY;
+				sprintf(str, "%s%.1f", i ? ", " : "", history[z][h]);
+				json += str;
+			}
+			json += "]";
+		}
+		json += "}";
+	}
+	json += "]}";
+	return json;
+}
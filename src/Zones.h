@@ -0,0 +1,78 @@
+#ifndef ZONES_H
+#define ZONES_H
+
+#include <PID_v10.h>
+#include <max31855.h>
+#include "Config.h"
+#include "Faults.h"
+
+#define ZONE_HISTORY 120
+
+// Heater zones in addition to the controller's own thermocouple, relay and
+// PID, which are not a zone and have their own measure and safety paths.
+// State is kept as one array per quantity and every zone is stepped in one
+// pass. Zones follow the controller target plus a per stage offset and
+// share its PID tunings.
+class Zones {
+public:
+	typedef enum {
+		ALL_OFF,
+		ALL_ON,
+		CONTROL,
+	} DRIVE_t;
+
+	Zones(Config& cfg);
+	~Zones();
+
+	void begin(uint8_t clk, uint8_t data);
+
+	uint8_t count() { return _count; }
+	const char * name(uint8_t zone) { return config.zones[zone].name.c_str(); }
+
+	void tune(double P, double I, double D);
+
+	void reset();
+
+	// per zone offset from the controller target, NULL for none
+	void offsets(const float * offsets);
+
+	void measure(unsigned long now);
+
+	void compute(unsigned long now, double target);
+
+	void log();
+
+	// takes the control of every zone for the next window
+	void latch();
+
+	void drive(DRIVE_t how, unsigned long phase, float window);
+
+	void write();
+
+	// first zone that trips a safety check, -1 if all is well
+	int check(unsigned long now, Faults::FAULT_t& fault);
+
+	String toJSON(bool with_history = false);
+
+	double temperature[ZONES_MAX];
+	double target[ZONES_MAX];
+	double control[ZONES_MAX];
+	// control latched for the current window
+	double duty[ZONES_MAX];
+	float offset[ZONES_MAX];
+	bool heater[ZONES_MAX];
+	unsigned long last_off[ZONES_MAX];
+	float history[ZONES_MAX][ZONE_HISTORY];
+
+private:
+	Config& config;
+	uint8_t _count;
+	uint16_t _history_head;
+	uint16_t _history_len;
+
+	MAX31855 * sensor[ZONES_MAX];
+	PID * pid[ZONES_MAX];
+	uint8_t relay[ZONES_MAX];
+};
+
+#endif
@@ -7,25 +7,54 @@
 #include <ArduinoJson.h>
 #include "AsyncJson.h"
 #include "Config.h"
+#include "Boot.h"
+#include "RunArchive.h"
+#include "RangeQuery.h"
+#include "EventLog.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Alloc.h"
+#include "Frames.h"
+#include "Broadcast.h"
+#include "Commands.h"
+#include <WiFi.h>
 
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 AsyncEventSource events("/event");
+EventLog eventLog(events);
+Broadcast broadcast(ws);
+Commands commands;
+
+#define RESYNC_CLIENTS 8
+// approximate JSON size of one reading (time, reading and target)
+#define RESYNC_BYTES_PER_READING 20
+
+struct {
+	unsigned long deltas;
+	unsigned long snapshots;
+	unsigned long bytes_sent;
+	unsigned long bytes_saved;
+} resync_stats;
 ControllerBase * controller = NULL;
 ControllerBase * last_controller = NULL;
 AsyncWebSocketClient * _client = NULL;
 Config config("/config.json", "/profiles.json");
-
-
+Boot boot;
+RunArchive archive;
+bool control_started = false;
+
+// Messages are serialized here instead of into a String. Whoever can't get
+// the lock (the network task while the loop task is sending) or has a
+// message that doesn't fit falls back to the heap.
+#define TEXT_BUFFER 1024
+char text_buffer[TEXT_BUFFER];
+SemaphoreHandle_t text_lock = NULL;
+
+// Events every client has to see, they are queued until it can take them.
+// State goes through broadcast.state(), where newer copies replace old ones.
 void textThem(const char * text) {
-	int tryId = 0;
-  for (int count = 0; count < ws.count();) {
-    if (ws.hasClient(tryId)) {
-      ws.client(tryId)->text(text);
-      count++;
-    }
-    tryId++;
-  }
+	broadcast.event(text);
 }
 
 void textThem(const String& text) {
@@ -33,13 +62,30 @@ void textThem(const String& text) {
 }
 
 void textThem(JsonObject &root, AsyncWebSocketClient * client) {
+	ALLOC_SCOPE(metrics.alloc_message);
 	String json;
-	root.printTo(json);
+	const char * text = text_buffer;
+	bool locked = false;
+	{
+		TRACE_SCOPE("json");
+		if (root.measureLength() < TEXT_BUFFER && xSemaphoreTake(text_lock, 0) == pdTRUE) {
+			locked = true;
+			root.printTo(text_buffer, TEXT_BUFFER);
+		} else {
+			root.printTo(json);
+			text = json.c_str();
+		}
+	}
+
+	if (client != NULL) {
+		ALLOC_SCOPE(metrics.alloc_socket);
+		client->text(text);
+		metrics.messages++;
+	} else
+		textThem(text);
 
-	if (client != NULL)
-		client->text(json);
-	else
-		textThem(json);
+	if (locked)
+		xSemaphoreGive(text_lock);
 }
 
 void textThem(JsonObject &root)
@@ -47,25 +93,13 @@ void textThem(JsonObject &root)
 	textThem(root, NULL);
 }
 
-void send_reading(float reading, float target, float time, AsyncWebSocketClient * client, bool reset)
+void send_reading(float reading, float target, float time, AsyncWebSocketClient * client, bool reset, unsigned long seq)
 {
 	S_printf("Sending readings...");
-	char str[255] = "";
-
-	StaticJsonBuffer<200> jsonBuffer;
-	JsonObject &root = jsonBuffer.createObject();
-
-	JsonObject& data = root.createNestedObject("readings");
-	JsonArray &times = root.createNestedArray("times");
-	JsonArray &readings = root.createNestedArray("readings");
-	JsonArray &targets = root.createNestedArray("targets");
-
-	times.add(time);
-	readings.add(reading);
-	targets.add(target);
-	data["reset"] = reset;
-
-	textThem(root);
+	Frame frame;
+	broadcast.state(Broadcast::READING, frame.reading(time, reading, target, reset, seq));
+	eventLog.publish("reading", "{\"time\": %.1f, \"reading\": %.2f, \"target\": %.2f, \"reset\": %s}",
+		time, reading, target, reset ? "true" : "false");
 }
 
 void setupController(ControllerBase * c)
@@ -77,41 +111,69 @@ void setupController(ControllerBase * c)
 
 	// report messages
 	c->onMessage([](const char * msg) {
-		StaticJsonBuffer<200> jsonBuffer;
-		JsonObject &root = jsonBuffer.createObject();
-		root["message"] = msg;
-		textThem(root);
+		Frame frame;
+		// the per tick PID dump is only interesting while it is current
+		if (strncmp(msg, "DEBUG", 5) == 0)
+			broadcast.state(Broadcast::DEBUG, frame.message(msg));
+		else
+			textThem(frame.message(msg));
 	});
 
 	c->onHeater([](bool heater) {
 		S_printf("Heater: %s", heater ? "on" : "off");
-		StaticJsonBuffer<200> jsonBuffer;
-		JsonObject &root = jsonBuffer.createObject();
-		root["heater"] = heater;
-		textThem(root);
+		Frame frame;
+		broadcast.state(Broadcast::HEATER, frame.heater(heater));
+		eventLog.publish("heater", "{\"heater\": %s}", heater ? "true" : "false");
 	});
 
 	// report readings
-	c->onReadingsReport([](const std::vector<ControllerBase::Temperature_t>& readings, unsigned long elapsed){
-		send_reading(controller->log_to_temperature(readings[readings.size() - 1]), controller->target(), elapsed/1000.0, NULL, readings.size() == 1);
+	c->onReadingsReport([](const Readings& readings, unsigned long elapsed){
+		archive.append(elapsed, controller->log_to_temperature(readings.last()), controller->target());
+		send_reading(controller->log_to_temperature(readings.last()), controller->target(), elapsed/1000.0, NULL, readings.last_seq() == readings.run_seq(), readings.last_seq());
 	});
 
 	// report mode change
 	c->onMode([](ControllerBase::MODE_t last, ControllerBase::MODE_t current){
 		S_printf("Change mode: from %s to %s", controller->translate_mode(last), controller->translate_mode(current));
-		StaticJsonBuffer<200> jsonBuffer;
-		JsonObject &root = jsonBuffer.createObject();
-		root["mode"] = controller->translate_mode(current);
-
-		textThem(root);
+		if (last <= ControllerBase::OFF && current > ControllerBase::OFF) {
+			// the first reading of the run has already been reported
+			archive.start(controller->profile(), current);
+			archive.append(0, controller->log_to_temperature(controller->readings().first()), controller->target());
+		} else if (last > ControllerBase::OFF && current <= ControllerBase::OFF) {
+			if (current == ControllerBase::ERROR_OFF)
+				archive.finish(RunArchive::FAULT);
+			else if (last == ControllerBase::REFLOW || last == ControllerBase::CALIBRATE)
+				archive.finish(RunArchive::ABORTED);
+			else
+				archive.finish(RunArchive::COMPLETE);
+		}
+		Frame frame;
+		broadcast.state(Broadcast::MODE, frame.mode(controller->translate_mode(current)));
+		eventLog.publish("mode", "{\"mode\": \"%s\"}", controller->translate_mode(current));
+	});
+	// replies to commands, once the controller has applied them
+	c->onCommand([](const ControllerBase::Command_t& command) {
+		Frame frame;
+		unsigned long now = millis();
+		switch (command.command) {
+			case ControllerBase::CMD_PROFILE:
+				textThem(frame.profile(controller->profile()));
+				break;
+			case ControllerBase::CMD_TARGET:
+				broadcast.state(Broadcast::TARGET, frame.target(controller->target()));
+				break;
+			case ControllerBase::CMD_REPORT:
+				send_reading(controller->temperature(), controller->target(), controller->elapsed(now)/1000.0, NULL, false, 0);
+				break;
+			default:
+				break;
+		}
 	});
 	c->onStage([](const char * stage, float target){
 		S_printf("Reflow stage: %s", stage);
-		StaticJsonBuffer<200> jsonBuffer;
-		JsonObject &root = jsonBuffer.createObject();
-		root["stage"] = stage;
-		root["target"] = target;
-		textThem(root);
+		Frame frame;
+		textThem(frame.stage(stage, target));
+		eventLog.publish("stage", "{\"stage\": \"%s\", \"target\": %.2f}", stage, target);
 	});
 
 	last_controller = tmp;
@@ -119,46 +181,195 @@ void setupController(ControllerBase * c)
 	S_printf("Controller setup DONE");
 }
 
-void send_data(AsyncWebSocketClient * client)
+// readings are copied out of the controller this many at a time
+#define SEND_CHUNK 64
+
+// Sends the state and the readings from sequence number `from` on. A
+// `from` at or before the oldest reading kept is a full snapshot. Runs on
+// the network task, everything comes from the controller's published
+// state and readings.
+size_t send_data(AsyncWebSocketClient * client, unsigned long from)
 {
 	S_printf("Sending all data...");
-	std::vector<ControllerBase::Temperature_t>::iterator I = controller->readings().begin();
-	std::vector<ControllerBase::Temperature_t>::iterator end = controller->readings().end();
-	DynamicJsonBuffer jsonBuffer;
-	JsonObject &root = jsonBuffer.createObject();
-	JsonArray &times = root.createNestedArray("times");
-	JsonArray &readings = root.createNestedArray("readings");
-	JsonArray &targets = root.createNestedArray("targets");
-	root["reset"] = true;
-	root["message"] = "INFO: Connected!";
-	root["mode"] = controller->translate_mode();
-	root["target"] = controller->target();
-	root["profile"] = controller->profile();
-	root["stage"] = controller->stage();
-	root["heater"] = controller->heater();
-
-	float seconds = 0;
-	while (I != end)
-	{
-		times.add(seconds);
-		readings.add(controller->log_to_temperature(*I));
-		targets.add(controller->target());
-		seconds += config.reportInterval / 1000.0;
-		I ++;
+	Readings& all = controller->readings();
+	float interval = config.reportInterval / 1000.0;
+
+	for (;;) {
+		ControllerBase::State_t state;
+		controller->state(state);
+		unsigned long run = all.run_seq();
+
+		DynamicJsonBuffer jsonBuffer;
+		JsonObject &root = jsonBuffer.createObject();
+		JsonArray &times = root.createNestedArray("times");
+		JsonArray &readings = root.createNestedArray("readings");
+		JsonArray &targets = root.createNestedArray("targets");
+		root["reset"] = from <= all.first_seq();
+		root["message"] = "INFO: Connected!";
+		root["mode"] = controller->translate_mode(state.mode);
+		root["target"] = state.target;
+		if (!isnan(state.board))
+			root["board"] = state.board;
+		root["profile"] = state.profile.c_str();
+		root["stage"] = state.stage.c_str();
+		root["heater"] = state.heater;
+		root["fault"] = Faults::translate(state.fault);
+
+		ControllerBase::Temperature_t chunk[SEND_CHUNK];
+		unsigned long seq = from;
+		unsigned long last = all.last_seq();
+		size_t n;
+		while ((n = all.copy(seq, chunk, SEND_CHUNK)) > 0) {
+			for (size_t i = 0; i < n; i++) {
+				times.add((seq + i - run) * interval);
+				readings.add(controller->log_to_temperature(chunk[i]));
+				targets.add(state.target);
+			}
+			seq += n;
+			last = seq - 1;
+		}
+		root["seq"] = last;
+
+		// a run started while we were at it, its readings don't go with ours
+		if (all.run_seq() != run)
+			continue;
+
+		textThem(root, client);
+		return root.measureLength();
+	}
+}
+
+// Clients that connected but have not told us yet what they have seen.
+// Old clients never send resync:, they get a full snapshot on their first
+// command instead.
+uint32_t unsynced[RESYNC_CLIENTS];
+
+bool take_unsynced(uint32_t id) {
+	for (int i = 0; i < RESYNC_CLIENTS; i++) {
+		if (unsynced[i] == id) {
+			unsynced[i] = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+void resync(AsyncWebSocketClient * client, unsigned long seq)
+{
+	unsigned long first = controller->first_seq();
+	unsigned long last = controller->last_seq();
+
+	if (seq == 0 || seq + 1 < first || seq > last) {
+		resync_stats.snapshots++;
+		resync_stats.bytes_sent += send_data(client, first);
+		return;
 	}
 
-	textThem(root, client);
+	resync_stats.deltas++;
+	resync_stats.bytes_sent += send_data(client, seq + 1);
+	resync_stats.bytes_saved += (seq + 1 - first) * RESYNC_BYTES_PER_READING;
+}
+
+// heating modes are refused while a fault is latched, check that before a
+// batch does anything
+const char * check_heating(const char * arg) {
+	ControllerBase::State_t state;
+	controller->state(state);
+	if (!state.ready)
+		return "Controller is warming up";
+	return state.fault != Faults::NONE ? "Fault is latched" : NULL;
+}
+
+void setupCommands()
+{
+	commands.on("WATCHDOG", [](AsyncWebSocketClient * client, const char * arg) {});
+	commands.on("profile", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_PROFILE, 0, arg);
+	}, [](const char * arg) -> const char * {
+		return config.profiles.find(arg) == config.profiles.end() ? "No such profile" : NULL;
+	});
+	commands.on("target", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_TARGET, strtod(arg, NULL));
+	}, [](const char * arg) -> const char * {
+		// the UIs send fractions and targets above MAX_TEMPERATURE, the
+		// controller clamps them like it always did
+		char * end;
+		double t = strtod(arg, &end);
+		return end == arg || isnan(t) ? "Target is not a number" : NULL;
+	});
+	commands.on("ON", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_MODE, ControllerBase::ON);
+	}, check_heating);
+	commands.on("CALIBRATE", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_MODE, ControllerBase::CALIBRATE);
+	}, check_heating);
+	commands.on("TARGET_PID", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_MODE, ControllerBase::TARGET_PID);
+	}, check_heating);
+	commands.on("REFLOW", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_MODE, ControllerBase::REFLOW);
+	}, check_heating);
+	commands.on("OFF", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_MODE, ControllerBase::OFF);
+	});
+	commands.on("COOLDOWN", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_MODE, ControllerBase::CALIBRATE_COOL);
+	});
+	commands.on("REBOOT", [](AsyncWebSocketClient * client, const char * arg) {
+		ESP.restart();
+	});
+	commands.on("FAULT-ACK", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_FAULT_ACK);
+	});
+	commands.on("FAULT-CLEAR", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_FAULT_CLEAR);
+	});
+	commands.on("CURRENT-TEMPERATURE", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_REPORT);
+	});
+	commands.on("ILC-RESET", [](AsyncWebSocketClient * client, const char * arg) {
+		controller->post(ControllerBase::CMD_ILC_RESET, 0, arg);
+	}, [](const char * arg) -> const char * {
+		ControllerBase::State_t state;
+		controller->state(state);
+		if (state.mode > ControllerBase::OFF)
+			return "Not while running";
+		return *arg && config.profiles.find(arg) == config.profiles.end() ? "No such profile" : NULL;
+	});
+
+	// everything of one frame reaches the controller in the same tick
+	commands.onFrame([](size_t n) -> const char * {
+		return controller->post_space() < n ? "Controller busy" : NULL;
+	}, []() {
+		controller->commit();
+	});
 }
 
 void setup() {
 	Serial.begin(115200);
+	text_lock = xSemaphoreCreateMutex();
 
 	// Seems we have to send an argument?
-	SPIFFS.begin(false);
-	config.load_config();
-	config.load_profiles();
-	config.setup_OTA();
+	boot.run("spiffs", []() { SPIFFS.begin(false); });
+	boot.run("config", []() {
+		config.load_config();
+		config.load_profiles();
+	});
+	boot.run("archive", []() { archive.begin(); });
+
+	// get the controller in place first, so we are in control of the heater
+	// as early as possible; everything else can happen around it
+	boot.run("controller", []() { setupController(new ReflowController(config)); });
+	boot.spawn("leds", []() { controller->led_test(); });
+	// warmup() prints the first reading, S_printf needs the bigger stack
+	boot.spawn("thermocouple", []() { controller->warmup(); }, 4096);
 
+	boot.run("ota", []() { config.setup_OTA(); });
+	boot.run("commands", setupCommands);
+
+	events.onConnect([](AsyncEventSourceClient *client) {
+		eventLog.replay(client);
+	});
 	server.addHandler(&ws);
 	server.addHandler(&events);
 	server.serveStatic("/", SPIFFS, "/web").setDefaultFile("index.html");
@@ -169,6 +380,12 @@ void setup() {
 		Serial.println("** DEBUG - main.cpp - server.on GET(/heap)");
 		request->send(200, "text/plain", String(ESP.getFreeHeap()));
 	});
+	server.on("/boot", HTTP_GET, [](AsyncWebServerRequest *request) {
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", boot.toJSON());
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
 	server.on("/profiles", HTTP_GET, [](AsyncWebServerRequest *request) {
 		Serial.println("** DEBUG - main.cpp - server.on GET(/profile)");
 		AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/profiles.json");
@@ -188,61 +405,142 @@ void setup() {
 		request->send(response);
 	});
 	server.on("/profiles", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-		config.save_profiles(request, data, len, index, total);
-		config.load_profiles();
+		// the controller loads them, once it isn't using the old ones
+		if (config.save_profiles(request, data, len, index, total) && index + len >= total)
+			controller->post(ControllerBase::CMD_PROFILES);
 	});
 	server.on("/config", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
 		config.save_config(request, data, len, index, total);
 	});
+	server.on("/faults", HTTP_GET, [](AsyncWebServerRequest *request) {
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", controller->faults().toJSON(millis()));
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
+	server.on("/runs", HTTP_GET, [](AsyncWebServerRequest *request) {
+		if (request->hasParam("id")) {
+			uint32_t id = request->getParam("id")->value().toInt();
+			bool csv = request->hasParam("format") && request->getParam("format")->value() == "csv";
+			AsyncWebServerResponse *response = archive.download(request, id, csv);
+			if (!response) {
+				request->send(404, "application/json", "{\"msg\": \"ERROR: no such run!\"}");
+				return;
+			}
+			response->addHeader("Access-Control-Allow-Origin", "*");
+			response->addHeader("Content-Disposition", "attachment; filename=run-" + String(id) + (csv ? ".csv" : ".bin"));
+			request->send(response);
+			return;
+		}
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", archive.toJSON());
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
+	server.on("/readings", HTTP_GET, [](AsyncWebServerRequest *request) {
+		float interval = config.reportInterval / 1000.0;
+		float from = request->hasParam("from") ? request->getParam("from")->value().toFloat() : 0;
+		Readings& all = controller->readings();
+		float to = request->hasParam("to") ? request->getParam("to")->value().toFloat() : (all.last_seq() - all.run_seq()) * interval;
+		float step = request->hasParam("step") ? request->getParam("step")->value().toFloat() : interval;
+
+		RangeQuery query(controller, interval, from, to, step);
+		AsyncWebServerResponse *response = query.response(request);
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
+	server.on("/resync", HTTP_GET, [](AsyncWebServerRequest *request) {
+		char str[160] = "";
+		sprintf(str, "{\"deltas\": %lu, \"snapshots\": %lu, \"bytes_sent\": %lu, \"bytes_saved\": %lu}",
+			resync_stats.deltas, resync_stats.snapshots, resync_stats.bytes_sent, resync_stats.bytes_saved);
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", str);
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
+	server.on("/broadcast", HTTP_GET, [](AsyncWebServerRequest *request) {
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", broadcast.toJSON(millis()));
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
+	server.on("/zones", HTTP_GET, [](AsyncWebServerRequest *request) {
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", controller->zones().toJSON(request->hasParam("history")));
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
+	server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+		AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+		metrics.render(response, ws);
+		request->send(response);
+	});
+	server.on("/trace", HTTP_GET, [](AsyncWebServerRequest *request) {
+		if (request->hasParam("clear")) {
+			trace.clear();
+			request->send(200, "application/json", "{\"msg\": \"INFO: trace cleared\"}");
+			return;
+		}
+		// tracing goes on during the download, events overwritten before they
+		// go out are left out of it
+		AsyncWebServerResponse *response = trace.response(request);
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Content-Disposition", "attachment; filename=trace.json");
+		request->send(response);
+	});
 	server.on("/calibration", HTTP_GET, [](AsyncWebServerRequest *request) {
 		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", controller->calibrationString());
 		response->addHeader("Access-Control-Allow-Origin", "*");
 		response->addHeader("Access-Control-Allow-Methods", "GET");
 		request->send(response);
 	});
+	server.on("/model", HTTP_GET, [](AsyncWebServerRequest *request) {
+		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", controller->modelString());
+		response->addHeader("Access-Control-Allow-Origin", "*");
+		response->addHeader("Access-Control-Allow-Methods", "GET");
+		request->send(response);
+	});
 	server.onNotFound(
 			[](AsyncWebServerRequest *request) { request->send(404); });
 
 	ws.onEvent([](AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len){
 		if (type == WS_EVT_DATA) {
-			char cmd[256] = "";
+			char cmd[COMMANDS_JSON] = "";
 			memcpy(cmd, data, min(len, sizeof(cmd) - 1));
 
-			controller->watchdog(millis());
-
 			Serial.print("** debug - main - onEvent cmd: ");
 			Serial.println(cmd);
-			if (strcmp(cmd, "WATCHDOG") == 0) {
-			} else if (strncmp(cmd, "profile:", 8) == 0) {
-				controller->profile(String(cmd + 8));
-				sprintf(cmd, "{\"profile\": \"%s\"}", controller->profile().c_str());
-				textThem(cmd);
-			} else if (strcmp(cmd, "ON") == 0) {
-				controller->mode(ControllerBase::ON);
-			} else if (strcmp(cmd, "REBOOT") == 0) {
-				ESP.restart();
-			} else if (strcmp(cmd, "CALIBRATE") == 0) {
-				controller->mode(ControllerBase::CALIBRATE);
-			} else if (strcmp(cmd, "TARGET_PID") == 0) {
-				controller->mode(ControllerBase::TARGET_PID);
-			} else if (strcmp(cmd, "REFLOW") == 0) {
-				controller->mode(ControllerBase::REFLOW);
-			} else if (strcmp(cmd, "OFF") == 0) {
-				controller->mode(ControllerBase::OFF);
-			} else if (strcmp(cmd, "COOLDOWN") == 0) {
-				controller->mode(ControllerBase::CALIBRATE_COOL);
-			} else if (strcmp(cmd, "CURRENT-TEMPERATURE") == 0) {
-				unsigned long now = millis();
-				send_reading(controller->measure_temperature(now), controller->target(), controller->elapsed(now)/1000.0, NULL, false);
-			} else if (strncmp(cmd, "target:", 7) == 0) {
-				controller->target(max(0, min(atoi(cmd + 7), MAX_TEMPERATURE)));
-				sprintf(cmd, "{\"target\": %.2f}", controller->target());
-				textThem(cmd);
+			bool fresh = take_unsynced(client->id());
+			// a resync only asks for data, e.g. from a collector; it doesn't
+			// say anyone is watching the oven
+			if (strncmp(cmd, "resync:", 7) == 0) {
+				resync(client, strtoul(cmd + 7, NULL, 10));
+				return;
 			}
+			controller->watchdog(millis());
+			if (fresh) {
+				resync(client, 0);
+			}
+
+			commands.handle(client, cmd);
 		} else if (type == WS_EVT_CONNECT) {
-			send_data(client);
+			if (!broadcast.connect(client)) {
+				client->text("{\"message\":\"ERROR: Too many clients!\"}");
+				client->close();
+				return;
+			}
+			// wait for resync: or the first command before sending history
+			for (int i = 0; i < RESYNC_CLIENTS; i++) {
+				if (unsynced[i] == 0) {
+					unsynced[i] = client->id();
+					break;
+				}
+			}
 			S_printf("Connected...");
 		} else if (type == WS_EVT_DISCONNECT) {
+			take_unsynced(client->id());
+			broadcast.disconnect(client->id());
 			S_printf("Disconnected...");
 			//controller->mode(ControllerBase::ERROR_OFF);
 		}
@@ -251,13 +549,17 @@ void setup() {
 	chipid = ESP.getEfuseMac();//The chip ID is essentially its MAC address(length: 6 bytes).
 	Serial.printf("ESP32 Chip ID = %04X",(uint16_t)(chipid>>32));//print High 2 bytes
 	Serial.printf("%08X\n",(uint32_t)chipid);//print Low 4bytes.
-	delay(3000);
-	
-	Serial.println("** debug - main - Starting actual WebServer");
-	server.begin();
-	setupController(new ReflowController(config));
 
-	S_printf("Server started..");
+	// the TCP stack is only usable once WiFi is up (station or AP), start
+	// the web server from loop() when that happens instead of waiting here
+	boot.defer("server", []() { return WiFi.getMode() != WIFI_OFF; }, []() {
+		Serial.println("** debug - main - Starting actual WebServer");
+		server.begin();
+		S_printf("Server started..");
+	});
+
+	// from here on allocations from loop() are counted, see /metrics
+	alloc_count_begin();
 }
 
 void loop() {
@@ -266,8 +568,20 @@ void loop() {
   	config.OTA->loop(now);
 	// since this is single core, we don't care about
 	// synchronization
-	if (controller)
-		controller->loop(now);
+	if (controller) {
+		{
+			MetricsTimer t(metrics.loop);
+			TRACE_SCOPE("loop");
+			ALLOC_SCOPE(metrics.alloc_tick);
+			controller->loop(now);
+		}
+		if (!control_started && controller->ready()) {
+			control_started = true;
+			boot.mark("control");
+		}
+	}
+	broadcast.loop(now);
+	boot.loop(now);
 	if (last_controller) {
 		delete last_controller;
 		last_controller = NULL;
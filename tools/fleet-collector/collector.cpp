@@ -0,0 +1,379 @@
+#include "collector.h"
+#include "ws.h"
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RETRY_MIN 1000.0
+#define RETRY_MAX 30000.0
+#define FLUSH_INTERVAL 1000.0
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// The firmware messages are flat JSON objects with a fixed set of keys, so
+// a key lookup is all we need instead of a JSON parser.
+static const char * json_find(const std::string& json, const char * key) {
+	std::string k = std::string("\"") + key + "\"";
+	size_t pos = json.find(k);
+	if (pos == std::string::npos)
+		return NULL;
+	const char * p = json.c_str() + pos + k.size();
+	while (*p == ' ' || *p == ':')
+		p++;
+	return p;
+}
+
+static bool json_number(const std::string& json, const char * key, double& value) {
+	const char * p = json_find(json, key);
+	if (!p)
+		return false;
+	char * end;
+	value = strtod(p, &end);
+	return end != p;
+}
+
+static bool json_bool(const std::string& json, const char * key, bool& value) {
+	const char * p = json_find(json, key);
+	if (!p)
+		return false;
+	value = strncmp(p, "true", 4) == 0;
+	return true;
+}
+
+static bool json_string(const std::string& json, const char * key, std::string& value) {
+	const char * p = json_find(json, key);
+	if (!p || *p != '"')
+		return false;
+	value.clear();
+	for (p++; *p && *p != '"'; p++) {
+		// escaped quotes are part of the string; \n, \t and the like stay
+		// escaped, events are stored one per line
+		if (*p == '\\' && p[1]) {
+			p++;
+			if (*p != '"' && *p != '\\' && *p != '/')
+				value += '\\';
+		}
+		value += *p;
+	}
+	return *p == '"';
+}
+
+static bool json_numbers(const std::string& json, const char * key, std::vector<float>& values) {
+	values.clear();
+	const char * p = json_find(json, key);
+	if (!p || *p != '[')
+		return false;
+	p++;
+	for (;;) {
+		while (*p == ' ' || *p == ',')
+			p++;
+		if (*p == ']' || !*p)
+			break;
+		char * end;
+		values.push_back(strtod(p, &end));
+		if (end == p)
+			return false;
+		p = end;
+	}
+	return true;
+}
+
+Collector::Collector(const std::string& store) :
+	_store(store) {
+	_epoll = epoll_create1(0);
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+Collector::~Collector() {
+	for (size_t i = 0; i < _ovens.size(); i++) {
+		if (_ovens[i]->fd >= 0)
+			close(_ovens[i]->fd);
+		delete _ovens[i]->store;
+		delete _ovens[i];
+	}
+	close(_epoll);
+}
+
+bool Collector::add(const std::string& url, const std::string& name) {
+	if (url.compare(0, 5, "ws://") != 0)
+		return false;
+
+	Oven * o = new Oven();
+	std::string rest = url.substr(5);
+	size_t slash = rest.find('/');
+	std::string hostport = rest.substr(0, slash);
+	o->path = slash == std::string::npos ? "/ws" : rest.substr(slash);
+	size_t colon = hostport.find(':');
+	o->host = hostport.substr(0, colon);
+	o->port = colon == std::string::npos ? "80" : hostport.substr(colon + 1);
+	o->name = name;
+	o->fd = -1;
+	o->state = IDLE;
+	o->retry_at = 0;
+	o->backoff = RETRY_MIN;
+	o->last_seq = 0;
+	o->store = new Store(_store, name);
+	if (!o->store->open()) {
+		fprintf(stderr, "%s: could not open store\n", name.c_str());
+		delete o->store;
+		delete o;
+		return false;
+	}
+	_ovens.push_back(o);
+	return true;
+}
+
+void Collector::watch(Oven * o) {
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (o->state == CONNECTING || !o->out.empty() ? EPOLLOUT : 0);
+	ev.data.ptr = o;
+	epoll_ctl(_epoll, EPOLL_CTL_MOD, o->fd, &ev);
+}
+
+void Collector::connect(Oven * o, double now) {
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(o->host.c_str(), o->port.c_str(), &hints, &res) != 0) {
+		o->retry_at = now + RETRY_MAX;
+		return;
+	}
+
+	o->fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int r = o->fd < 0 ? -1 : ::connect(o->fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (r < 0 && errno != EINPROGRESS) {
+		disconnect(o, now);
+		return;
+	}
+
+	o->state = CONNECTING;
+	o->in.clear();
+	o->out.clear();
+	o->fragment.clear();
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.ptr = o;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, o->fd, &ev);
+}
+
+void Collector::disconnect(Oven * o, double now) {
+	if (o->fd >= 0) {
+		epoll_ctl(_epoll, EPOLL_CTL_DEL, o->fd, NULL);
+		close(o->fd);
+		o->fd = -1;
+	}
+	if (o->state == OPEN)
+		_stats.disconnects++;
+	o->state = IDLE;
+	o->retry_at = now + o->backoff;
+	o->backoff = o->backoff * 2 > RETRY_MAX ? RETRY_MAX : o->backoff * 2;
+	o->store->flush();
+}
+
+void Collector::flush(Oven * o) {
+	while (!o->out.empty()) {
+		ssize_t n = write(o->fd, o->out.data(), o->out.size());
+		if (n <= 0)
+			break;
+		o->out.erase(0, n);
+	}
+	watch(o);
+}
+
+void Collector::send(Oven * o, const std::string& text) {
+	ws::frame(o->out, ws::OP_TEXT, text.data(), text.size(), true);
+	flush(o);
+}
+
+void Collector::handle(Oven * o, uint32_t events, double now) {
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		disconnect(o, now);
+		return;
+	}
+
+	if (o->state == CONNECTING && (events & EPOLLOUT)) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(o->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err) {
+			disconnect(o, now);
+			return;
+		}
+		o->key = ws::random_key();
+		o->out = "GET " + o->path + " HTTP/1.1\r\nHost: " + o->host + "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+			"Sec-WebSocket-Key: " + o->key + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+		o->state = HANDSHAKE;
+	}
+
+	if (events & EPOLLOUT)
+		flush(o);
+	if (events & EPOLLIN)
+		receive(o, now);
+}
+
+void Collector::receive(Oven * o, double now) {
+	uint8_t buf[16384];
+	for (;;) {
+		ssize_t n = read(o->fd, buf, sizeof(buf));
+		if (n == 0 || (n < 0 && errno != EAGAIN)) {
+			disconnect(o, now);
+			return;
+		}
+		if (n < 0)
+			break;
+		o->in.insert(o->in.end(), buf, buf + n);
+		_stats.bytes += n;
+	}
+
+	if (o->state == HANDSHAKE) {
+		std::string head(o->in.begin(), o->in.end());
+		size_t end = head.find("\r\n\r\n");
+		if (end == std::string::npos)
+			return;
+		std::string expected = "Sec-WebSocket-Accept: " + ws::accept_key(o->key);
+		if (head.compare(0, 12, "HTTP/1.1 101") != 0 || head.find(expected) == std::string::npos) {
+			fprintf(stderr, "%s: handshake failed\n", o->name.c_str());
+			disconnect(o, now);
+			return;
+		}
+		o->in.erase(o->in.begin(), o->in.begin() + end + 4);
+		o->state = OPEN;
+		o->backoff = RETRY_MIN;
+		_stats.connects++;
+
+		// The firmware doesn't feed its watchdog from resync frames, the
+		// only ones we send, so a collector never keeps a heater alive.
+		char cmd[32];
+		snprintf(cmd, sizeof(cmd), "resync:%u", o->last_seq);
+		send(o, cmd);
+	}
+
+	size_t pos = 0;
+	while (pos < o->in.size()) {
+		uint8_t opcode;
+		bool fin;
+		const char * payload;
+		size_t len;
+		size_t used = ws::parse(&o->in[pos], o->in.size() - pos, opcode, fin, payload, len);
+		if (!used)
+			break;
+		pos += used;
+
+		if (opcode == ws::OP_CLOSE) {
+			o->in.clear();
+			disconnect(o, now);
+			return;
+		} else if (opcode == ws::OP_PING) {
+			ws::frame(o->out, ws::OP_PONG, payload, len, true);
+			flush(o);
+		} else if (opcode == ws::OP_TEXT || opcode == ws::OP_CONTINUATION) {
+			o->fragment.append(payload, len);
+			if (fin) {
+				message(o, o->fragment);
+				o->fragment.clear();
+			}
+		}
+	}
+	o->in.erase(o->in.begin(), o->in.begin() + pos);
+}
+
+void Collector::message(Oven * o, const std::string& text) {
+	_stats.messages++;
+
+	std::vector<float> times, readings, targets;
+	double seq = 0;
+	// readings without a seq, like the replies to CURRENT-TEMPERATURE, are
+	// repeats of ones that come with it
+	if (json_numbers(text, "times", times) && json_numbers(text, "readings", readings) && json_number(text, "seq", seq)) {
+		json_numbers(text, "targets", targets);
+		bool reset = false;
+		json_bool(text, "reset", reset);
+
+		// sequence numbers start over when the controller reboots
+		if (reset && seq < o->last_seq)
+			o->last_seq = 0;
+
+		// a message carries the readings up to and including seq
+		uint32_t first = (uint32_t)seq - readings.size() + 1;
+		if (!reset && o->last_seq && first > o->last_seq + 1) {
+			// missed some, the controller sends the gap on resync
+			_stats.gaps++;
+			char cmd[32];
+			snprintf(cmd, sizeof(cmd), "resync:%u", o->last_seq);
+			send(o, cmd);
+			return;
+		}
+
+		for (size_t i = 0; i < readings.size() && i < times.size(); i++) {
+			uint32_t s = first + i;
+			// already have it, e.g. a snapshot after reconnecting
+			if (s <= o->last_seq)
+				continue;
+			o->store->reading(s, times[i], readings[i], i < targets.size() ? targets[i] : NAN, reset && i == 0);
+			_stats.readings++;
+		}
+		o->last_seq = seq;
+	}
+
+	static const char * keys[] = {"mode", "stage", "profile", "message", "fault"};
+	std::string value;
+	for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+		if (json_string(text, keys[k], value)) {
+			o->store->event(keys[k], value);
+			_stats.events++;
+		}
+	}
+	bool heater;
+	if (json_bool(text, "heater", heater)) {
+		o->store->event("heater", heater ? "on" : "off");
+		_stats.events++;
+	}
+}
+
+uint64_t Collector::stored_bytes() {
+	uint64_t total = 0;
+	for (size_t i = 0; i < _ovens.size(); i++)
+		total += _ovens[i]->store->bytes();
+	return total;
+}
+
+void Collector::run(volatile bool& stop, double seconds) {
+	struct epoll_event events[512];
+	double start = now_ms();
+	double next_flush = start + FLUSH_INTERVAL;
+
+	while (!stop && (seconds <= 0 || now_ms() - start < seconds * 1000)) {
+		double now = now_ms();
+		for (size_t i = 0; i < _ovens.size(); i++)
+			if (_ovens[i]->state == IDLE && now >= _ovens[i]->retry_at)
+				connect(_ovens[i], now);
+
+		int n = epoll_wait(_epoll, events, 512, 100);
+		now = now_ms();
+		for (int i = 0; i < n; i++)
+			handle((Oven *)events[i].data.ptr, events[i].events, now);
+
+		if (now >= next_flush) {
+			next_flush = now + FLUSH_INTERVAL;
+			for (size_t i = 0; i < _ovens.size(); i++)
+				_ovens[i]->store->flush();
+		}
+	}
+
+	for (size_t i = 0; i < _ovens.size(); i++)
+		_ovens[i]->store->flush();
+}
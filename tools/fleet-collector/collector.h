@@ -0,0 +1,81 @@
+#ifndef FLEET_COLLECTOR_H
+#define FLEET_COLLECTOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "store.h"
+
+// Connects to controllers over their /ws WebSocket and feeds readings and
+// events into a Store per oven. All connections share one epoll loop.
+class Collector {
+public:
+	typedef struct {
+		uint64_t connects;
+		uint64_t disconnects;
+		uint64_t messages;
+		uint64_t readings;
+		uint64_t events;
+		uint64_t gaps;
+		uint64_t bytes;
+	} Stats_t;
+
+	Collector(const std::string& store);
+	~Collector();
+
+	// ws://host[:port][/path], name is the store directory for the oven
+	bool add(const std::string& url, const std::string& name);
+
+	// runs until stop is set or `seconds` have passed (0 for ever)
+	void run(volatile bool& stop, double seconds);
+
+	const Stats_t& stats() { return _stats; }
+
+	uint64_t stored_bytes();
+
+	size_t ovens() { return _ovens.size(); }
+
+private:
+	enum {
+		IDLE,
+		CONNECTING,
+		HANDSHAKE,
+		OPEN,
+	};
+
+	struct Oven {
+		std::string name;
+		std::string host;
+		std::string port;
+		std::string path;
+		std::string key;
+
+		int fd;
+		int state;
+		double retry_at;
+		double backoff;
+
+		std::string out;
+		std::vector<uint8_t> in;
+		std::string fragment;
+
+		uint32_t last_seq;
+		Store * store;
+	};
+
+	std::string _store;
+	std::vector<Oven *> _ovens;
+	int _epoll;
+	Stats_t _stats;
+
+	void connect(Oven * o, double now);
+	void disconnect(Oven * o, double now);
+	void handle(Oven * o, uint32_t events, double now);
+	void receive(Oven * o, double now);
+	void message(Oven * o, const std::string& text);
+	void send(Oven * o, const std::string& text);
+	void flush(Oven * o);
+	void watch(Oven * o);
+};
+
+#endif
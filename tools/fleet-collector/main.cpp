@@ -0,0 +1,163 @@
+// fleet-collector: collects readings and events from many reflow
+// controllers into a columnar store.
+//
+//   fleet-collector [options] ws://oven-1.local/ws ws://10.0.0.12/ws ...
+//   fleet-collector --simulate 500 --duration 30
+//
+// options:
+//   --store DIR       where to keep the data (default ./fleet-data)
+//   --duration SEC    stop after SEC seconds (default: run until killed)
+//   --simulate N      add N simulated ovens on a loopback port
+//   --period MS       reading period of the simulated ovens (default 500)
+//   --report SEC      print throughput every SEC seconds (default 5)
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "collector.h"
+#include "sim.h"
+
+static volatile bool stop = false;
+
+static void on_signal(int) {
+	stop = true;
+}
+
+static long rss_kb() {
+	long pages = 0, resident = 0;
+	FILE * f = fopen("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long peak_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static double now_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: fleet-collector [--store DIR] [--duration SEC] [--simulate N] [--period MS] [--report SEC] [ws://host[:port]/ws ...]\n");
+}
+
+static void report(Collector& collector, Simulator * sim, double elapsed, const Collector::Stats_t& last, double interval) {
+	const Collector::Stats_t& s = collector.stats();
+	printf("%8.1fs ovens=%zu connected=%llu msgs=%llu (%.0f/s) readings=%llu (%.0f/s) in=%.2f MB/s gaps=%llu stored=%.1f MB rss=%ld kB",
+		elapsed, collector.ovens(), (unsigned long long)(s.connects - s.disconnects),
+		(unsigned long long)s.messages, (s.messages - last.messages) / interval,
+		(unsigned long long)s.readings, (s.readings - last.readings) / interval,
+		(s.bytes - last.bytes) / interval / 1e6, (unsigned long long)s.gaps,
+		collector.stored_bytes() / 1e6, rss_kb());
+	if (sim)
+		printf(" sim_sent=%llu", (unsigned long long)sim->messages());
+	printf("\n");
+	fflush(stdout);
+}
+
+int main(int argc, char ** argv) {
+	std::string store = "./fleet-data";
+	double duration = 0;
+	int simulate = 0;
+	int period = 500;
+	double every = 5;
+	std::vector<std::string> urls;
+
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (strcmp(argv[i], "--store") == 0 && more)
+			store = argv[++i];
+		else if (strcmp(argv[i], "--duration") == 0 && more)
+			duration = atof(argv[++i]);
+		else if (strcmp(argv[i], "--simulate") == 0 && more)
+			simulate = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--period") == 0 && more)
+			period = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--report") == 0 && more)
+			every = atof(argv[++i]);
+		else if (strncmp(argv[i], "ws://", 5) == 0)
+			urls.push_back(argv[i]);
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (urls.empty() && simulate == 0) {
+		usage();
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	// every oven needs a socket plus a few files, and so does every
+	// simulated one
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	mkdir(store.c_str(), 0755);
+	Collector collector(store);
+
+	for (size_t i = 0; i < urls.size(); i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "oven-%zu", i + 1);
+		if (!collector.add(urls[i], name))
+			fprintf(stderr, "skipping %s\n", urls[i].c_str());
+	}
+
+	Simulator * sim = NULL;
+	if (simulate) {
+		sim = new Simulator(period);
+		if (!sim->start()) {
+			fprintf(stderr, "could not start the simulator\n");
+			return 1;
+		}
+		for (int i = 0; i < simulate; i++) {
+			char url[64], name[32];
+			snprintf(url, sizeof(url), "ws://127.0.0.1:%u/ws?oven=%d", sim->port(), i + 1);
+			snprintf(name, sizeof(name), "sim-%d", i + 1);
+			if (!collector.add(url, name))
+				fprintf(stderr, "skipping %s\n", url);
+		}
+	}
+
+	double start = now_s();
+	Collector::Stats_t last = collector.stats();
+	while (!stop && (duration <= 0 || now_s() - start < duration)) {
+		double slice = every;
+		if (duration > 0 && duration - (now_s() - start) < slice)
+			slice = duration - (now_s() - start);
+		collector.run(stop, slice);
+		report(collector, sim, now_s() - start, last, slice);
+		last = collector.stats();
+	}
+
+	double elapsed = now_s() - start;
+	const Collector::Stats_t& s = collector.stats();
+	printf("total: %.1fs, %llu messages (%.0f/s), %llu readings (%.0f/s), %llu events, %.2f MB received, %.2f MB stored, peak rss %ld kB\n",
+		elapsed, (unsigned long long)s.messages, s.messages / elapsed, (unsigned long long)s.readings, s.readings / elapsed,
+		(unsigned long long)s.events, s.bytes / 1e6, collector.stored_bytes() / 1e6, peak_rss_kb());
+
+	if (sim) {
+		sim->stop();
+		delete sim;
+	}
+	return 0;
+}
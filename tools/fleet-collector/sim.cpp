@@ -0,0 +1,304 @@
+#include "sim.h"
+#include "ws.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_RUN_READINGS 90
+#define SIM_MAX_OUT (1 << 20)
+
+static const char * stages[] = {"preheat", "soak", "reflow", "cooldown"};
+static const float stage_targets[] = {150, 200, 250, 50};
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+Simulator::Simulator(int period_ms) :
+	_period(period_ms),
+	_listen(-1),
+	_epoll(-1),
+	_port(0),
+	_running(false),
+	_messages(0),
+	_bytes(0) {
+}
+
+Simulator::~Simulator() {
+	stop();
+}
+
+bool Simulator::start() {
+	_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (_listen < 0)
+		return false;
+
+	int one = 1;
+	setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if (bind(_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(_listen, 1024) < 0)
+		return false;
+
+	socklen_t len = sizeof(addr);
+	getsockname(_listen, (struct sockaddr *)&addr, &len);
+	_port = ntohs(addr.sin_port);
+
+	_epoll = epoll_create1(0);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, _listen, &ev);
+
+	_running = true;
+	_thread = std::thread(&Simulator::run, this);
+	return true;
+}
+
+void Simulator::stop() {
+	if (!_running)
+		return;
+	_running = false;
+	_thread.join();
+
+	for (std::map<int, Oven *>::iterator I = _ovens.begin(); I != _ovens.end(); I++) {
+		::close(I->first);
+		delete I->second;
+	}
+	_ovens.clear();
+	::close(_listen);
+	::close(_epoll);
+}
+
+void Simulator::run() {
+	struct epoll_event events[256];
+	double next = now_ms() + _period;
+
+	while (_running) {
+		int timeout = (int)(next - now_ms());
+		int n = epoll_wait(_epoll, events, 256, timeout > 0 ? timeout : 0);
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL)
+				accept_all();
+			else
+				handle((Oven *)events[i].data.ptr, events[i].events);
+		}
+
+		if (now_ms() >= next) {
+			next += _period;
+			std::vector<Oven *> ovens;
+			for (std::map<int, Oven *>::iterator I = _ovens.begin(); I != _ovens.end(); I++)
+				ovens.push_back(I->second);
+			for (size_t i = 0; i < ovens.size(); i++)
+				if (ovens[i]->open)
+					tick(ovens[i]);
+		}
+	}
+}
+
+void Simulator::accept_all() {
+	for (;;) {
+		int fd = accept4(_listen, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0)
+			return;
+
+		Oven * o = new Oven();
+		o->fd = fd;
+		o->id = 0;
+		o->open = false;
+		o->synced = false;
+		o->seq = 0;
+		o->first_seq = 1;
+		o->temperature = 25;
+		o->target = stage_targets[0];
+		o->stage = 0;
+		o->heater = false;
+		_ovens[fd] = o;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = o;
+		epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+void Simulator::handle(Oven * o, uint32_t events) {
+	if (events & (EPOLLHUP | EPOLLERR)) {
+		close(o);
+		return;
+	}
+	if (events & EPOLLOUT)
+		flush(o);
+	if (!(events & EPOLLIN))
+		return;
+
+	char buf[4096];
+	for (;;) {
+		ssize_t n = read(o->fd, buf, sizeof(buf));
+		if (n == 0 || (n < 0 && errno != EAGAIN)) {
+			close(o);
+			return;
+		}
+		if (n < 0)
+			break;
+		o->in.append(buf, n);
+	}
+
+	if (!o->open) {
+		handshake(o);
+		return;
+	}
+
+	for (;;) {
+		uint8_t opcode;
+		bool fin;
+		const char * payload;
+		size_t len;
+		size_t used = ws::parse((uint8_t *)&o->in[0], o->in.size(), opcode, fin, payload, len);
+		if (!used)
+			break;
+		std::string text(payload, len);
+		o->in.erase(0, used);
+		if (opcode == ws::OP_CLOSE) {
+			close(o);
+			return;
+		}
+		if (opcode == ws::OP_TEXT)
+			command(o, text);
+	}
+}
+
+void Simulator::handshake(Oven * o) {
+	size_t end = o->in.find("\r\n\r\n");
+	if (end == std::string::npos)
+		return;
+
+	std::string request = o->in.substr(0, end);
+	o->in.erase(0, end + 4);
+
+	size_t q = request.find("oven=");
+	o->id = q != std::string::npos ? atoi(request.c_str() + q + 5) : o->fd;
+	// spread the ovens over the profile
+	o->seq = o->id * 1000;
+	o->first_seq = o->seq + 1;
+	o->stage = o->id % 3;
+	o->target = stage_targets[o->stage];
+
+	std::string key;
+	size_t k = request.find("Sec-WebSocket-Key:");
+	if (k != std::string::npos) {
+		k += 18;
+		while (request[k] == ' ')
+			k++;
+		key = request.substr(k, request.find("\r\n", k) - k);
+	}
+
+	o->out += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+	o->out += ws::accept_key(key);
+	o->out += "\r\n\r\n";
+	o->open = true;
+	flush(o);
+}
+
+void Simulator::command(Oven * o, const std::string& cmd) {
+	if (o->synced || cmd.compare(0, 7, "resync:") != 0) {
+		o->synced = true;
+		return;
+	}
+	o->synced = true;
+
+	// like the firmware: only what was missed, or all of the current run
+	uint32_t last = strtoul(cmd.c_str() + 7, NULL, 10);
+	bool reset = last == 0 || last + 1 < o->first_seq || last > o->seq;
+	size_t from = reset ? 0 : last + 1 - o->first_seq;
+
+	char str[128];
+	std::string times, readings, targets;
+	for (size_t i = from; i < o->history.size(); i++) {
+		snprintf(str, sizeof(str), "%s%.1f", i > from ? ", " : "", i * _period / 1000.0);
+		times += str;
+		snprintf(str, sizeof(str), "%s%.2f", i > from ? ", " : "", o->history[i]);
+		readings += str;
+		snprintf(str, sizeof(str), "%s%.2f", i > from ? ", " : "", o->target);
+		targets += str;
+	}
+	snprintf(str, sizeof(str), "], \"reset\": %s, \"seq\": %u, \"message\": \"INFO: Connected!\", \"mode\": \"Reflow\", \"stage\": \"%s\", \"heater\": %s}",
+		reset ? "true" : "false", o->seq, stages[o->stage], o->heater ? "true" : "false");
+	send(o, "{\"times\": [" + times + "], \"readings\": [" + readings + "], \"targets\": [" + targets + str);
+}
+
+void Simulator::tick(Oven * o) {
+	char str[160];
+
+	if (o->history.size() >= SIM_RUN_READINGS) {
+		o->first_seq = o->seq + 1;
+		o->history.clear();
+		o->stage = 0;
+		o->target = stage_targets[0];
+		send(o, "{\"mode\": \"Reflow\"}");
+	}
+
+	// first order plant with the heater on below target
+	bool heater = o->temperature < o->target;
+	o->temperature += (heater ? 4.0 : -1.5) * _period / 1000.0 + (rand() % 100 - 50) / 100.0;
+	if (heater != o->heater) {
+		o->heater = heater;
+		send(o, heater ? "{\"heater\": true}" : "{\"heater\": false}");
+	}
+	if (o->history.size() == (size_t)(o->stage + 1) * SIM_RUN_READINGS / 4 && o->stage < 3) {
+		o->stage++;
+		o->target = stage_targets[o->stage];
+		snprintf(str, sizeof(str), "{\"stage\": \"%s\", \"target\": %.2f}", stages[o->stage], o->target);
+		send(o, str);
+	}
+
+	o->seq++;
+	o->history.push_back(o->temperature);
+	snprintf(str, sizeof(str), "{\"times\": [%.1f], \"readings\": [%.2f], \"targets\": [%.2f], \"reset\": %s, \"seq\": %u}",
+		(o->history.size() - 1) * _period / 1000.0, o->temperature, o->target, o->history.size() == 1 ? "true" : "false", o->seq);
+	send(o, str);
+}
+
+void Simulator::send(Oven * o, const std::string& text) {
+	if (o->out.size() > SIM_MAX_OUT)
+		return;
+	ws::frame(o->out, ws::OP_TEXT, text.data(), text.size(), false);
+	_messages++;
+	_bytes += text.size();
+	flush(o);
+}
+
+void Simulator::flush(Oven * o) {
+	while (!o->out.empty()) {
+		ssize_t n = write(o->fd, o->out.data(), o->out.size());
+		if (n <= 0)
+			break;
+		o->out.erase(0, n);
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (o->out.empty() ? 0 : EPOLLOUT);
+	ev.data.ptr = o;
+	epoll_ctl(_epoll, EPOLL_CTL_MOD, o->fd, &ev);
+}
+
+void Simulator::close(Oven * o) {
+	epoll_ctl(_epoll, EPOLL_CTL_DEL, o->fd, NULL);
+	::close(o->fd);
+	_ovens.erase(o->fd);
+	delete o;
+}
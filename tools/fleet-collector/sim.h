@@ -0,0 +1,66 @@
+#ifndef FLEET_SIM_H
+#define FLEET_SIM_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Simulated controllers for load testing. Listens on one loopback port and
+// plays a reflow oven for every WebSocket connection (/ws?oven=N), using
+// the same messages as the firmware.
+class Simulator {
+public:
+	Simulator(int period_ms);
+	~Simulator();
+
+	bool start();
+	void stop();
+
+	uint16_t port() { return _port; }
+
+	uint64_t messages() { return _messages; }
+	uint64_t bytes() { return _bytes; }
+
+private:
+	struct Oven {
+		int fd;
+		int id;
+		bool open;
+		bool synced;
+		std::string in;
+		std::string out;
+
+		uint32_t seq;			// sequence number of the last reading
+		uint32_t first_seq;		// sequence number of the first reading of the run
+		float temperature;
+		float target;
+		int stage;
+		bool heater;
+		std::vector<float> history;
+	};
+
+	int _period;
+	int _listen;
+	int _epoll;
+	uint16_t _port;
+	volatile bool _running;
+	std::thread _thread;
+	std::map<int, Oven *> _ovens;
+
+	uint64_t _messages;
+	uint64_t _bytes;
+
+	void run();
+	void accept_all();
+	void handle(Oven * o, uint32_t events);
+	void handshake(Oven * o);
+	void command(Oven * o, const std::string& cmd);
+	void tick(Oven * o);
+	void send(Oven * o, const std::string& text);
+	void flush(Oven * o);
+	void close(Oven * o);
+};
+
+#endif
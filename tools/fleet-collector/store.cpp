@@ -0,0 +1,114 @@
+#include "store.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define STORE_BUFFER 16384
+
+static const char * column_names[] = {"seq.u32", "time.f32", "temperature.f32", "target.f32"};
+
+Store::Store(const std::string& root, const std::string& oven) :
+	_dir(root + "/" + oven),
+	_events(NULL),
+	_index(NULL),
+	_in_run(false),
+	_rows(0),
+	_bytes(0) {
+	memset(&_run, 0, sizeof(_run));
+	for (int c = 0; c < COLUMNS; c++)
+		_columns[c].f = NULL;
+}
+
+Store::~Store() {
+	flush();
+	// the run still open is indexed with what we got of it
+	if (_in_run && _index)
+		write_run();
+	for (int c = 0; c < COLUMNS; c++)
+		if (_columns[c].f)
+			fclose(_columns[c].f);
+	if (_events)
+		fclose(_events);
+	if (_index)
+		fclose(_index);
+}
+
+bool Store::open() {
+	if (mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST)
+		return false;
+
+	for (int c = 0; c < COLUMNS; c++) {
+		_columns[c].f = fopen((_dir + "/" + column_names[c]).c_str(), "ab");
+		if (!_columns[c].f)
+			return false;
+		_columns[c].buffer.reserve(STORE_BUFFER);
+	}
+	_events = fopen((_dir + "/events.log").c_str(), "a");
+	_index = fopen((_dir + "/runs.idx").c_str(), "a+b");
+	if (!_events || !_index)
+		return false;
+
+	// carry on the row and run numbering of earlier sessions
+	fseek(_columns[SEQ].f, 0, SEEK_END);
+	_rows = ftell(_columns[SEQ].f) / sizeof(uint32_t);
+	fseek(_index, 0, SEEK_END);
+	_run.run = ftell(_index) / sizeof(Run_t);
+	return true;
+}
+
+void Store::append(int column, const void * value, size_t size) {
+	Column& c = _columns[column];
+	c.buffer.insert(c.buffer.end(), (const char *)value, (const char *)value + size);
+	if (c.buffer.size() >= STORE_BUFFER) {
+		fwrite(c.buffer.data(), 1, c.buffer.size(), c.f);
+		c.buffer.clear();
+	}
+	_bytes += size;
+}
+
+void Store::write_run() {
+	fwrite(&_run, sizeof(_run), 1, _index);
+	fflush(_index);
+	_bytes += sizeof(_run);
+}
+
+void Store::reading(uint32_t seq, float time, float temperature, float target, bool reset) {
+	if (reset || !_in_run) {
+		if (_in_run)
+			write_run();
+		_run.run++;
+		_run.first_row = _rows;
+		_run.rows = 0;
+		_run.started = ::time(NULL);
+		_in_run = true;
+	}
+
+	append(SEQ, &seq, sizeof(seq));
+	append(TIME, &time, sizeof(time));
+	append(TEMPERATURE, &temperature, sizeof(temperature));
+	append(TARGET, &target, sizeof(target));
+	_run.rows++;
+	_rows++;
+}
+
+void Store::event(const char * type, const std::string& value) {
+	int n = fprintf(_events, "%llu\t%s\t%s\n", (unsigned long long)_rows, type, value.c_str());
+	if (n > 0)
+		_bytes += n;
+}
+
+void Store::flush() {
+	for (int c = 0; c < COLUMNS; c++) {
+		Column& col = _columns[c];
+		if (!col.f)
+			continue;
+		if (!col.buffer.empty()) {
+			fwrite(col.buffer.data(), 1, col.buffer.size(), col.f);
+			col.buffer.clear();
+		}
+		fflush(col.f);
+	}
+	if (_events)
+		fflush(_events);
+}
@@ -0,0 +1,64 @@
+#ifndef FLEET_STORE_H
+#define FLEET_STORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Append-only columnar store, one directory per oven:
+//
+//   seq.u32 time.f32 temperature.f32 target.f32   one value per reading
+//   events.log                                    row<TAB>type<TAB>value
+//   runs.idx                                      Run_t per finished run
+//
+// Every column grows by one value per reading, so row n of a run is found
+// at (first_row + n) * sizeof(value) in each column file.
+class Store {
+public:
+	typedef struct {
+		uint32_t run;
+		uint32_t first_row;
+		uint32_t rows;
+		uint32_t started;		// unix time the collector saw the run start
+	} Run_t;
+
+	Store(const std::string& root, const std::string& oven);
+	~Store();
+
+	bool open();
+
+	void reading(uint32_t seq, float time, float temperature, float target, bool reset);
+
+	void event(const char * type, const std::string& value);
+
+	void flush();
+
+	uint64_t bytes() { return _bytes; }
+
+	uint64_t rows() { return _rows; }
+
+private:
+	enum { SEQ, TIME, TEMPERATURE, TARGET, COLUMNS };
+
+	struct Column {
+		FILE * f;
+		std::vector<char> buffer;
+	};
+
+	std::string _dir;
+	Column _columns[COLUMNS];
+	FILE * _events;
+	FILE * _index;
+
+	Run_t _run;
+	bool _in_run;
+	uint64_t _rows;
+	uint64_t _bytes;
+
+	void append(int column, const void * value, size_t size);
+
+	void write_run();
+};
+
+#endif
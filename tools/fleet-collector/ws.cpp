@@ -0,0 +1,155 @@
+#include "ws.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace ws {
+
+std::string base64(const uint8_t * data, size_t len) {
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	out.reserve((len + 2) / 3 * 4);
+	for (size_t i = 0; i < len; i += 3) {
+		uint32_t n = data[i] << 16;
+		if (i + 1 < len) n |= data[i + 1] << 8;
+		if (i + 2 < len) n |= data[i + 2];
+		out += table[(n >> 18) & 63];
+		out += table[(n >> 12) & 63];
+		out += i + 1 < len ? table[(n >> 6) & 63] : '=';
+		out += i + 2 < len ? table[n & 63] : '=';
+	}
+	return out;
+}
+
+static inline uint32_t rol(uint32_t v, int n) {
+	return (v << n) | (v >> (32 - n));
+}
+
+void sha1(const uint8_t * data, size_t len, uint8_t digest[20]) {
+	uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+	// message plus 0x80, zero padding and the 64 bit length
+	size_t total = ((len + 8) / 64 + 1) * 64;
+	std::string msg((const char *)data, len);
+	msg += (char)0x80;
+	msg.append(total - len - 9, '\0');
+	uint64_t bits = (uint64_t)len * 8;
+	for (int i = 7; i >= 0; i--)
+		msg += (char)(bits >> (i * 8));
+
+	for (size_t chunk = 0; chunk < total; chunk += 64) {
+		uint32_t w[80];
+		const uint8_t * p = (const uint8_t *)msg.data() + chunk;
+		for (int i = 0; i < 16; i++)
+			w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+		for (int i = 16; i < 80; i++)
+			w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; i++) {
+			uint32_t f, k;
+			if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+			uint32_t t = rol(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = rol(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+
+	for (int i = 0; i < 5; i++) {
+		digest[i * 4] = h[i] >> 24;
+		digest[i * 4 + 1] = h[i] >> 16;
+		digest[i * 4 + 2] = h[i] >> 8;
+		digest[i * 4 + 3] = h[i];
+	}
+}
+
+std::string accept_key(const std::string& key) {
+	std::string s = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	uint8_t digest[20];
+	sha1((const uint8_t *)s.data(), s.size(), digest);
+	return base64(digest, sizeof(digest));
+}
+
+std::string random_key() {
+	uint8_t nonce[16];
+	for (int i = 0; i < 16; i++)
+		nonce[i] = rand() & 0xff;
+	return base64(nonce, sizeof(nonce));
+}
+
+void frame(std::string& out, uint8_t opcode, const char * data, size_t len, bool mask) {
+	out += (char)(0x80 | opcode);
+	uint8_t m = mask ? 0x80 : 0;
+	if (len < 126) {
+		out += (char)(m | len);
+	} else if (len < 65536) {
+		out += (char)(m | 126);
+		out += (char)(len >> 8);
+		out += (char)len;
+	} else {
+		out += (char)(m | 127);
+		for (int i = 7; i >= 0; i--)
+			out += (char)((uint64_t)len >> (i * 8));
+	}
+
+	if (!mask) {
+		out.append(data, len);
+		return;
+	}
+
+	uint8_t key[4];
+	for (int i = 0; i < 4; i++)
+		key[i] = rand() & 0xff;
+	out.append((const char *)key, 4);
+	size_t start = out.size();
+	out.append(data, len);
+	for (size_t i = 0; i < len; i++)
+		out[start + i] ^= key[i & 3];
+}
+
+size_t parse(uint8_t * buf, size_t len, uint8_t& opcode, bool& fin, const char *& payload, size_t& payload_len) {
+	if (len < 2)
+		return 0;
+
+	fin = buf[0] & 0x80;
+	opcode = buf[0] & 0x0f;
+	bool masked = buf[1] & 0x80;
+	uint64_t n = buf[1] & 0x7f;
+	size_t pos = 2;
+
+	if (n == 126) {
+		if (len < 4)
+			return 0;
+		n = (buf[2] << 8) | buf[3];
+		pos = 4;
+	} else if (n == 127) {
+		if (len < 10)
+			return 0;
+		n = 0;
+		for (int i = 0; i < 8; i++)
+			n = (n << 8) | buf[2 + i];
+		pos = 10;
+	}
+
+	uint8_t key[4] = {0, 0, 0, 0};
+	if (masked) {
+		if (len < pos + 4)
+			return 0;
+		memcpy(key, buf + pos, 4);
+		pos += 4;
+	}
+	if (len - pos < n)
+		return 0;
+
+	if (masked)
+		for (size_t i = 0; i < n; i++)
+			buf[pos + i] ^= key[i & 3];
+
+	payload = (const char *)buf + pos;
+	payload_len = n;
+	return pos + n;
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef FLEET_WS_H
+#define FLEET_WS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Just enough RFC 6455 for talking to the controllers: handshake keys,
+// text/close/ping frames, no extensions.
+namespace ws {
+	enum {
+		OP_CONTINUATION = 0x0,
+		OP_TEXT = 0x1,
+		OP_BINARY = 0x2,
+		OP_CLOSE = 0x8,
+		OP_PING = 0x9,
+		OP_PONG = 0xA,
+	};
+
+	std::string base64(const uint8_t * data, size_t len);
+
+	void sha1(const uint8_t * data, size_t len, uint8_t digest[20]);
+
+	// Sec-WebSocket-Accept for a Sec-WebSocket-Key
+	std::string accept_key(const std::string& key);
+
+	std::string random_key();
+
+	// appends a frame; clients have to mask, servers must not
+	void frame(std::string& out, uint8_t opcode, const char * data, size_t len, bool mask);
+
+	// parses one frame from the front of buf, returns bytes consumed or 0
+	// if the frame is not complete yet; payload is unmasked in place
+	size_t parse(uint8_t * buf, size_t len, uint8_t& opcode, bool& fin, const char *& payload, size_t& payload_len);
+}
+
+#endif
@@ -0,0 +1,162 @@
+// frame-bench: bytes, time and heap allocations per controller event for
+// the FrameWriter templates against building the frame into a heap string,
+// the way the callbacks did with printTo(String).
+//
+//   make run
+//   make run ARDUINOJSON=~/.platformio/lib/ArduinoJson/src
+//
+// With ARDUINOJSON set the baseline is the actual StaticJsonBuffer<200> +
+// printTo() path, otherwise snprintf into a std::string stands in for it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <new>
+#include "../../src/Frames.h"
+
+#ifdef HAVE_ARDUINOJSON
+#define ARDUINOJSON_ENABLE_STD_STRING 1
+#include <ArduinoJson.h>
+#endif
+
+static unsigned long allocs = 0;
+
+void * operator new(size_t size) {
+	allocs++;
+	void * p = malloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) noexcept {
+	free(p);
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define ITERATIONS 1000000
+
+static const char * MESSAGE = "DEBUG: PID: <code>e=1.250000     i=0.031000     d=-0.004000       Tt=150.000000       T=148.750000     C=0.412000     rate=1.020000</code>";
+
+// keeps the compiler from dropping the work
+static volatile size_t sink;
+
+struct Result {
+	size_t bytes;
+	double ns;
+	double allocs;
+};
+
+template<typename F>
+static Result measure(F f) {
+	Result r;
+	r.bytes = f(0);
+	unsigned long a = allocs;
+	double start = now_ns();
+	for (int i = 0; i < ITERATIONS; i++)
+		sink = f(i);
+	r.ns = (now_ns() - start) / ITERATIONS;
+	r.allocs = (double)(allocs - a) / ITERATIONS;
+	return r;
+}
+
+static void report(const char * event, Result old, Result frame) {
+	printf("%-8s %8zu %8.1f %8.2f   %8zu %8.1f %8.2f   %5.1fx\n", event,
+		old.bytes, old.ns, old.allocs, frame.bytes, frame.ns, frame.allocs, old.ns / frame.ns);
+}
+
+#ifdef HAVE_ARDUINOJSON
+#define BASELINE "ArduinoJson printTo(std::string)"
+
+static size_t old_message(int i) {
+	StaticJsonBuffer<200> jsonBuffer;
+	JsonObject &root = jsonBuffer.createObject();
+	root["message"] = MESSAGE;
+	std::string json;
+	root.printTo(json);
+	return json.size();
+}
+
+static size_t old_heater(int i) {
+	StaticJsonBuffer<200> jsonBuffer;
+	JsonObject &root = jsonBuffer.createObject();
+	root["heater"] = (bool)(i & 1);
+	std::string json;
+	root.printTo(json);
+	return json.size();
+}
+
+static size_t old_stage(int i) {
+	StaticJsonBuffer<200> jsonBuffer;
+	JsonObject &root = jsonBuffer.createObject();
+	root["stage"] = "reflow";
+	root["target"] = 217.5f + (i & 7);
+	std::string json;
+	root.printTo(json);
+	return json.size();
+}
+
+static size_t old_reading(int i) {
+	StaticJsonBuffer<200> jsonBuffer;
+	JsonObject &root = jsonBuffer.createObject();
+	root.createNestedArray("times").add(i * .5f);
+	root.createNestedArray("readings").add(148.75f + (i & 15));
+	root.createNestedArray("targets").add(150.0f);
+	root["reset"] = false;
+	root["seq"] = (unsigned long)i + 1;
+	std::string json;
+	root.printTo(json);
+	return json.size();
+}
+#else
+#define BASELINE "snprintf into std::string"
+
+static size_t old_message(int i) {
+	std::string json = std::string("{\"message\":\"") + MESSAGE + "\"}";
+	return json.size();
+}
+
+static size_t old_heater(int i) {
+	std::string json = std::string("{\"heater\":") + ((i & 1) ? "true" : "false") + "}";
+	return json.size();
+}
+
+static size_t old_stage(int i) {
+	char str[200];
+	snprintf(str, sizeof(str), "{\"stage\":\"%s\",\"target\":%.2f}", "reflow", 217.5f + (i & 7));
+	std::string json(str);
+	return json.size();
+}
+
+static size_t old_reading(int i) {
+	char str[200];
+	snprintf(str, sizeof(str), "{\"times\":[%.1f],\"readings\":[%.2f],\"targets\":[%.2f],\"reset\":false,\"seq\":%lu}",
+		i * .5f, 148.75f + (i & 15), 150.0f, (unsigned long)i + 1);
+	std::string json(str);
+	return json.size();
+}
+#endif
+
+static Frame frame;
+
+static size_t new_message(int i) { frame.message(MESSAGE); return frame.length(); }
+static size_t new_heater(int i) { frame.heater(i & 1); return frame.length(); }
+static size_t new_stage(int i) { frame.stage("reflow", 217.5f + (i & 7)); return frame.length(); }
+static size_t new_reading(int i) { frame.reading(i * .5f, 148.75f + (i & 15), 150.0f, false, i + 1); return frame.length(); }
+
+int main() {
+	printf("baseline: %s, %d iterations\n\n", BASELINE, ITERATIONS);
+	printf("%-8s %8s %8s %8s   %8s %8s %8s\n", "", "bytes", "ns", "allocs", "bytes", "ns", "allocs");
+	printf("%-8s %26s   %26s\n", "event", "baseline", "FrameWriter");
+	report("message", measure(old_message), measure(new_message));
+	report("heater", measure(old_heater), measure(new_heater));
+	report("stage", measure(old_stage), measure(new_stage));
+	report("reading", measure(old_reading), measure(new_reading));
+	return 0;
+}
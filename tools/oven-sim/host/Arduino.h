@@ -0,0 +1,26 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// just enough of the Arduino API for the PID library on a host
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+// simulated clock, advanced by the simulation
+extern unsigned long sim_micros;
+inline unsigned long micros() { return sim_micros; }
+inline unsigned long millis() { return sim_micros / 1000; }
+
+struct HostSerial {
+	void println(const char *) {}
+	void print(const char *) {}
+};
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,546 @@
+// Host simulation of the reflow controller against a simple oven model.
+// Runs the real PID library (lib/PID_v1) through a profile with the stage
+// logic of ReflowController and reports per stage how well it tracked.
+#include <Arduino.h>
+#include <PID_v10.h>
+#include "Ilc.h"
+#include "DutyMap.h"
+#include "Program.h"
+#include "Cascade.h"
+#include "Smith.h"
+#include "Model.h"
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+unsigned long sim_micros = 0;
+HostSerial Serial;
+
+#define TICK_MS 10
+#define INTERVAL_MS 500
+#define SAMPLE_MIN_MS 100
+#define AMBIENT 25.0
+
+// Two lumps: the heater (element and plate) and the board under the probe.
+// The heater stores enough heat to keep the board climbing after it is
+// switched off, the probe reads the board late and in 0.25 C steps.
+struct Oven {
+	double heater, board;
+	std::vector<double> delay;
+	size_t head;
+
+	Oven(double dead_s) : heater(AMBIENT), board(AMBIENT), delay((size_t)(dead_s * 1000 / TICK_MS) + 1, AMBIENT), head(0) {}
+
+	void step(bool on, double dt) {
+		double dh = (on ? 9.0 : 0) - (heater - board) * 0.08 - (heater - AMBIENT) * 0.012;
+		double db = (heater - board) * 0.045 - (board - AMBIENT) * 0.006;
+		heater += dh * dt;
+		board += db * dt;
+		delay[head] = board;
+		head = (head + 1) % delay.size();
+	}
+
+	double probe() {
+		return floor(delay[head] * 4) / 4;
+	}
+
+	// a thermocouple on the heater plate itself
+	double plate() {
+		return floor(heater * 4) / 4;
+	}
+};
+
+struct Gains {
+	const char * name;
+	double P, I, D;
+};
+
+static const Gains gains[] = {
+	{"ramp", 0.15, 0.006, 1.5},
+	{"peak", 0.1, 0.004, 2},
+	// Keep Target, as in data/profiles.json
+	{"default", 0.101859, 0.001773, 0.3901274},
+};
+
+struct Stage {
+	const char * name;
+	const char * pid;
+	double target, rate, stay;
+};
+
+static const Stage profile[] = {
+	{"preheat", "ramp", 150, 1.5, 60},
+	{"soak", "ramp", 180, 0.5, 40},
+	{"reflow", "peak", 230, 1.5, 30},
+	{"cooldown", "ramp", 50, 2, 0},
+};
+#define STAGES (sizeof(profile) / sizeof(profile[0]))
+
+// gain schedule [temperature, gains] as in profiles.json
+static const struct { double temperature; int gains; } schedule[] = {
+	{150, 0},
+	{210, 1},
+};
+
+enum Strategy { RESET, BUMPLESS, SCHEDULE };
+static const char * strategies[] = {"reset", "bumpless", "schedule"};
+
+struct Result {
+	double peak_error;		// furthest past the stage target
+	double ramp_error;		// mean |error| before the stage target is reached
+	double stay_error;		// mean |error| while staying
+	double jump;			// output change at the first computation of the stage
+	double ramp_s, stay_s;
+};
+
+static const Gains& find(const char * name) {
+	for (size_t i = 0; i < sizeof(gains) / sizeof(gains[0]); i++)
+		if (!strcmp(gains[i].name, name))
+			return gains[i];
+	return gains[0];
+}
+
+static void scheduled(double t, double& P, double& I, double& D) {
+	size_t n = sizeof(schedule) / sizeof(schedule[0]);
+	size_t i = 0;
+	while (i < n && schedule[i].temperature < t)
+		i++;
+	if (i == 0 || i == n) {
+		const Gains& g = gains[schedule[i == 0 ? 0 : n - 1].gains];
+		P = g.P; I = g.I; D = g.D;
+		return;
+	}
+	const Gains& a = gains[schedule[i - 1].gains];
+	const Gains& b = gains[schedule[i].gains];
+	double f = (t - schedule[i - 1].temperature) / (schedule[i].temperature - schedule[i - 1].temperature);
+	P = a.P + (b.P - a.P) * f;
+	I = a.I + (b.I - a.I) * f;
+	D = a.D + (b.D - a.D) * f;
+}
+
+// the profile as Config::Profile::compile() has it
+static void compile(Program& program) {
+	program.clear();
+	for (size_t s = 0; s < STAGES; s++) {
+		program.emit(Program::STAGE, s);
+		program.emit(Program::REACH, 0, 0, profile[s].target);
+		program.emit(Program::STAY, 0, 0, profile[s].stay);
+	}
+	program.emit(Program::END);
+}
+
+// one run of the profile; with ilc its feedforward is applied and the
+// tracking error recorded
+static void run(Strategy strategy, Result * results, Ilc * ilc = NULL) {
+	Oven oven(1.5);
+	double temperature = AMBIENT, target = AMBIENT, output = 0, rate = 0;
+	PID pid(&temperature, &output, &target, gains[0].P, gains[0].I, gains[0].D, DIRECT);
+	sim_micros = 0;
+	pid.SetSampleTime(SAMPLE_MIN_MS * 1000);
+	pid.SetOutputLimits(0, 1);
+	pid.SetMode(AUTOMATIC);
+
+	size_t stage = STAGES;
+	unsigned long stage_start = 0, last_m = 0, window = 0;
+	double start_temperature = AMBIENT;
+	bool check_jump = false;
+	double before = 0;
+
+	auto enter = [&](size_t s) {
+		stage = s;
+		stage_start = 0;
+		start_temperature = temperature;
+		target = profile[s].rate > 0 ? (s == 0 ? temperature : profile[s - 1].target) : profile[s].target;
+		const Gains& g = find(profile[s].pid);
+		if (strategy == RESET) {
+			pid.Reset();
+			pid.SetTunings(g.P, g.I, g.D);
+		} else if (strategy == BUMPLESS) {
+			pid.Retune(g.P, g.I, g.D);
+		}
+		memset(&results[s], 0, sizeof(Result));
+		before = output;
+		check_jump = s > 0;
+	};
+	Program program;
+	compile(program);
+	ProgramRunner runner;
+	runner.begin(&program, 0);
+	ProgramRunner::Inputs_t in = {(float)temperature, 0, NULL, 0};
+	runner.step(0, in);
+	enter(runner.stage());
+	if (strategy == SCHEDULE) {
+		double P, I, D;
+		scheduled(temperature, P, I, D);
+		pid.SetTunings(P, I, D);
+	}
+	pid.Reset();
+
+	for (unsigned long now = 0; stage < STAGES && now < 3600000UL; now += TICK_MS) {
+		sim_micros = now * 1000;
+		const Stage& st = profile[stage];
+		double direction = st.target >= start_temperature ? 1 : -1;
+
+		if (now - last_m >= INTERVAL_MS) {
+			double last = temperature;
+			temperature = oven.probe();
+			double dt = now - last_m;
+			rate += (1000.0 * (temperature - last) / dt - rate) * dt / (dt + 9 * INTERVAL_MS);
+			last_m = now;
+
+			// ReflowController::handle_target()
+			if (st.rate > 0 && fabs(rate) <= st.rate) {
+				double d = target <= st.target ? 1 : -1;
+				if (d * (temperature - st.target) < 0 && (d * (temperature - target) > 0 || fabs(rate) < st.rate)) {
+					double next = target + d * st.rate * dt / 1000.0;
+					target = d > 0 ? std::min(next, st.target) : std::max(next, st.target);
+				}
+			}
+
+			if (strategy == SCHEDULE) {
+				double P, I, D;
+				scheduled(temperature, P, I, D);
+				pid.Retune(P, I, D);
+			}
+			pid.Compute(now * 1000);
+			if (check_jump) {
+				results[stage].jump = fabs(output - before);
+				check_jump = false;
+			}
+
+			Result& r = results[stage];
+			if (stage_start == 0) {
+				r.ramp_error += fabs(temperature - target) * dt / 1000;
+				r.ramp_s += dt / 1000;
+			} else {
+				double error = temperature - st.target;
+				r.peak_error = std::max(r.peak_error, direction * error);
+				r.stay_error += fabs(error) * dt / 1000;
+				r.stay_s += dt / 1000;
+			}
+		}
+
+		// ReflowController::run()
+		in.temperature = temperature;
+		in.rate = rate;
+		switch (runner.step(now, in)) {
+			case ProgramRunner::ENTER:
+				enter(runner.stage());
+				continue;
+			case ProgramRunner::REACHED:
+				stage_start = now;
+				if (st.rate <= 0)
+					target = st.target;
+				pid.Reset();
+				break;
+			case ProgramRunner::DONE:
+			case ProgramRunner::ABORT:
+				stage = STAGES;
+				continue;
+			default:
+				break;
+		}
+
+		double control = output;
+		if (ilc) {
+			control = constrain(output + ilc->at(now), 0.0, 1.0);
+			if (now % INTERVAL_MS == 0)
+				ilc->track(now, target - temperature, control);
+		}
+
+		if (now - window >= INTERVAL_MS)
+			window = now;
+		bool heater = (now - window < INTERVAL_MS * control && control > .01) || (now - window >= INTERVAL_MS * control && control > .99);
+		oven.step(heater, TICK_MS / 1000.0);
+	}
+}
+
+// Keep Target through a few setpoints, with the learned holding duty of
+// src/DutyMap.cpp as in ControllerBase::handle_measure(); reports how long
+// each setpoint took to settle within 2 C for good
+static const double holds[] = {100, 150, 200, 150};
+#define HOLD_S 600
+#define HOLDS (sizeof(holds) / sizeof(holds[0]))
+
+static void hold(DutyMap * map, double * arrive, double * settle, double * ff_used) {
+	Oven oven(1.5);
+	double temperature = AMBIENT, target = holds[0], output = 0, rate = 0, ff = 0, last_target = NAN;
+	PID pid(&temperature, &output, &target, find("default").P, find("default").I, find("default").D, DIRECT);
+	sim_micros = 0;
+	pid.SetSampleTime(SAMPLE_MIN_MS * 1000);
+	pid.SetOutputLimits(0, 1);
+	pid.SetMode(AUTOMATIC);
+	pid.Reset();
+
+	unsigned long last_m = 0, window = 0;
+	double control = 0;
+	for (size_t h = 0; h < HOLDS; h++) {
+		target = holds[h];
+		unsigned long start = h * HOLD_S * 1000UL;
+		settle[h] = 0;
+		arrive[h] = NAN;
+		ff_used[h] = NAN;
+		for (unsigned long now = start; now < start + HOLD_S * 1000UL; now += TICK_MS) {
+			sim_micros = now * 1000;
+			if (now - last_m >= INTERVAL_MS) {
+				double last = temperature;
+				temperature = oven.probe();
+				double dt = now - last_m;
+				rate += (1000.0 * (temperature - last) / dt - rate) * dt / (dt + 9 * INTERVAL_MS);
+				last_m = now;
+
+				if (map) {
+					if (target == last_target && fabs(temperature - target) < DUTY_MAP_BAND && fabs(rate) < DUTY_MAP_RATE)
+						map->learn(target, control);
+					last_target = target;
+					double f = map->at(target);
+					f = isnan(f) ? 0 : f;
+					if (f != ff) {
+						ff = f;
+						pid.SetOutputLimits(-ff, 1 - ff);
+					}
+					if (isnan(ff_used[h]))
+						ff_used[h] = ff;
+				}
+				pid.Compute(now * 1000);
+				control = constrain(output + ff, 0.0, 1.0);
+				if (fabs(temperature - target) > .5)
+					settle[h] = (now - start) / 1000.0;
+				// a stage of ReflowController resets the PID once it is reached
+				if (isnan(arrive[h]) && fabs(temperature - target) < 2) {
+					arrive[h] = (now - start) / 1000.0;
+					pid.Reset();
+				}
+			}
+			if (now - window >= INTERVAL_MS)
+				window = now;
+			bool heater = (now - window < INTERVAL_MS * control && control > .01) || (now - window >= INTERVAL_MS * control && control > .99);
+			oven.step(heater, TICK_MS / 1000.0);
+		}
+	}
+}
+
+// Keep Target on the board temperature through the same setpoints: a
+// single loop on the plate probe, one on the board probe, and the cascade
+// of src/Cascade.cpp with the plate loop inside and the board loop
+// outside. Reports for each setpoint the board's overshoot, when it
+// settled within 2 C and its mean error over the last two minutes, and
+// the hottest the plate got.
+enum Loop { PLATE, BOARD, CASCADE };
+static const char * loops[] = {"plate", "board", "cascade"};
+static const Gains inner = {"plate", 0.05, 0.004, 0.2};
+static const Gains outer = {"board", 1.5, 0.03, 0};
+#define CASCADE_MS 2000
+
+static void cascade(Loop loop, double * overshoot, double * settle, double * error, double * plate_max) {
+	Oven oven(1.5);
+	const Gains& g = loop == BOARD ? find("default") : inner;
+	double plate = AMBIENT, board = AMBIENT, setpoint = holds[0], target = holds[0], output = 0;
+	double * input = loop == BOARD ? &board : &plate;
+	PID pid(input, &output, &setpoint, g.P, g.I, g.D, DIRECT);
+	sim_micros = 0;
+	pid.SetSampleTime(SAMPLE_MIN_MS * 1000);
+	pid.SetOutputLimits(0, 1);
+	pid.SetMode(AUTOMATIC);
+	pid.Reset();
+	Cascade outer_loop;
+	outer_loop.begin(outer.P, outer.I, outer.D, CASCADE_MS, 50);
+	outer_loop.reset(0);
+
+	unsigned long last_m = 0, window = 0;
+	for (size_t h = 0; h < HOLDS; h++) {
+		target = holds[h];
+		unsigned long start = h * HOLD_S * 1000UL;
+		double direction = h && holds[h] < holds[h - 1] ? -1 : 1;
+		overshoot[h] = settle[h] = error[h] = 0;
+		plate_max[h] = 0;
+		int n = 0;
+		for (unsigned long now = start; now < start + HOLD_S * 1000UL; now += TICK_MS) {
+			sim_micros = now * 1000;
+			if (now - last_m >= INTERVAL_MS) {
+				plate = oven.plate();
+				board = oven.probe();
+				last_m = now;
+				if (loop == CASCADE) {
+					if (outer_loop.due(now))
+						outer_loop.measure(now, board);
+					setpoint = outer_loop.compute(now, target, plate, output);
+				} else
+					setpoint = target;
+				pid.Compute(now * 1000);
+
+				overshoot[h] = std::max(overshoot[h], direction * (board - target));
+				if (fabs(board - target) > 2)
+					settle[h] = (now - start) / 1000.0;
+				if (now - start >= (HOLD_S - 120) * 1000UL) {
+					error[h] += fabs(board - target);
+					n++;
+				}
+				plate_max[h] = std::max(plate_max[h], plate);
+			}
+			if (now - window >= INTERVAL_MS)
+				window = now;
+			bool heater = (now - window < INTERVAL_MS * output && output > .01) || (now - window >= INTERVAL_MS * output && output > .99);
+			oven.step(heater, TICK_MS / 1000.0);
+		}
+		error[h] /= n;
+	}
+}
+
+// The plant model of src/Model.cpp watching the heater and the probe,
+// either through duty steps or through a profile run under the PID.
+// Prints the estimate every two minutes with `report`.
+#define IDENTIFY_S 1200
+
+static Model::Params_t identify(double probe_s, bool steps, bool report) {
+	Oven oven(probe_s);
+	Model model;
+	model.begin(0, NULL);
+	const Gains& g = find("default");
+	double temperature = AMBIENT, target = AMBIENT, output = 0;
+	PID pid(&temperature, &output, &target, g.P, g.I, g.D, DIRECT);
+	sim_micros = 0;
+	pid.SetSampleTime(SAMPLE_MIN_MS * 1000);
+	pid.SetOutputLimits(0, 1);
+	pid.SetMode(AUTOMATIC);
+	pid.Reset();
+	unsigned long window = 0;
+	for (unsigned long now = 0; now < IDENTIFY_S * 1000UL; now += TICK_MS) {
+		sim_micros = now * 1000;
+		// ramps up and holds, like the stages of a profile
+		target = std::min(AMBIENT + now / 1000.0, now < IDENTIFY_S * 500UL ? 150.0 : 200.0);
+		if (now % INTERVAL_MS == 0) {
+			temperature = oven.probe();
+			model.measure(now, temperature);
+			if (steps)
+				output = (now / 60000) % 2 ? .3 : .7;
+			else
+				pid.Compute(now * 1000);
+		}
+		if (report && now % 120000 == 0 && now) {
+			const Model::Params_t& m = model.params();
+			printf("%-8s %6lu %8.1f %8.1f %8.1f %8u %8s\n", steps ? "steps" : "profile", now / 1000,
+				m.gain, m.tau, m.dead, m.fits, model.valid() ? "yes" : "no");
+		}
+		if (now - window >= INTERVAL_MS)
+			window = now;
+		bool heater = (now - window < INTERVAL_MS * output && output > .01) || (now - window >= INTERVAL_MS * output && output > .99);
+		model.heater(now, heater);
+		oven.step(heater, TICK_MS / 1000.0);
+	}
+	return model.params();
+}
+
+// Keep Target on an oven with a slow probe (6 s dead time on top of the
+// plate's lag): the configured gains, gains twice as tight, and the tight
+// gains with the Smith predictor of src/Smith.cpp using the model
+// identified during a profile run.
+#define SLOW_PROBE 6.0
+static const Gains tight = {"tight", 0.2, 0.0035, 0.8};
+
+static void predicted(const Gains& g, const Model::Params_t * m, double * overshoot, double * settle, double * error) {
+	Oven oven(SLOW_PROBE);
+	double temperature = AMBIENT, input = AMBIENT, target = holds[0], output = 0;
+	PID pid(&input, &output, &target, g.P, g.I, g.D, DIRECT);
+	sim_micros = 0;
+	pid.SetSampleTime(SAMPLE_MIN_MS * 1000);
+	pid.SetOutputLimits(0, 1);
+	pid.SetMode(AUTOMATIC);
+	Smith smith;
+	if (m)
+		smith.begin(m->gain, m->tau, m->dead, temperature);
+	smith.reset(0, temperature);
+	pid.Reset();
+
+	unsigned long window = 0;
+	for (size_t h = 0; h < HOLDS; h++) {
+		target = holds[h];
+		unsigned long start = h * HOLD_S * 1000UL;
+		double direction = h && holds[h] < holds[h - 1] ? -1 : 1;
+		overshoot[h] = settle[h] = error[h] = 0;
+		int n = 0;
+		for (unsigned long now = start; now < start + HOLD_S * 1000UL; now += TICK_MS) {
+			sim_micros = now * 1000;
+			if (now % INTERVAL_MS == 0) {
+				temperature = oven.probe();
+				// ControllerBase::handle_measure()
+				smith.advance(now);
+				input = temperature + smith.correction();
+				pid.Compute(now * 1000);
+				smith.apply(output);
+
+				overshoot[h] = std::max(overshoot[h], direction * (temperature - target));
+				if (fabs(temperature - target) > 2)
+					settle[h] = (now - start) / 1000.0;
+				if (now - start >= (HOLD_S - 120) * 1000UL) {
+					error[h] += fabs(temperature - target);
+					n++;
+				}
+			}
+			if (now - window >= INTERVAL_MS)
+				window = now;
+			bool heater = (now - window < INTERVAL_MS * output && output > .01) || (now - window >= INTERVAL_MS * output && output > .99);
+			oven.step(heater, TICK_MS / 1000.0);
+		}
+		error[h] /= n;
+	}
+}
+
+int main(int argc, char ** argv) {
+	printf("%-10s %-10s %8s %8s %8s %8s\n", "strategy", "stage", "jump", "ramp", "peak", "stay");
+	for (int s = RESET; s <= SCHEDULE; s++) {
+		Result results[STAGES];
+		run((Strategy)s, results);
+		for (size_t i = 0; i + 1 < STAGES; i++) {
+			Result& r = results[i];
+			printf("%-10s %-10s %8.3f %8.2f %+8.1f %8.2f\n", strategies[s], profile[i].name,
+				r.jump, r.ramp_s ? r.ramp_error / r.ramp_s : 0, r.peak_error, r.stay_s ? r.stay_error / r.stay_s : 0);
+		}
+	}
+
+	// the plant model (src/Model.cpp); the oven's gain is 9 / (.08 * .006 /
+	// .045 + .012 * .051 / .045) = 371 C, its slow time constant 123 s
+	printf("\n%-8s %6s %8s %8s %8s %8s %8s\n", "model", "s", "K", "tau", "dead", "fits", "valid");
+	identify(1.5, true, true);
+	identify(1.5, false, true);
+
+	// repeated runs with the learned feedforward (src/Ilc.cpp)
+	printf("\n%-6s %12s\n", "run", "mean error");
+	Ilc ilc;
+	for (int n = 1; n <= 10; n++) {
+		Result results[STAGES];
+		run(BUMPLESS, results, &ilc);
+		printf("%-6d %12.2f\n", n, ilc.learn());
+	}
+
+	// Keep Target without and with the holding duties, twice from the same map
+	printf("\n%-10s %8s %8s %8s %8s\n", "duty map", "target", "arrive", "settle", "ff");
+	DutyMap map;
+	for (int n = 0; n < 3; n++) {
+		double arrive[HOLDS], settle[HOLDS], ff[HOLDS];
+		hold(n ? &map : NULL, arrive, settle, ff);
+		for (size_t h = 0; h < HOLDS; h++)
+			printf("%-10s %8.0f %8.1f %8.1f %8.3f\n", n == 0 ? "none" : n == 1 ? "learning" : "learned", holds[h], arrive[h], settle[h] - arrive[h], n ? ff[h] : 0.0);
+	}
+
+	// board temperature under a single loop and under the cascade
+	printf("\n%-10s %8s %8s %8s %8s %8s\n", "loop", "target", "over", "settle", "error", "plate");
+	for (int l = PLATE; l <= CASCADE; l++) {
+		double overshoot[HOLDS], settle[HOLDS], error[HOLDS], plate[HOLDS];
+		cascade((Loop)l, overshoot, settle, error, plate);
+		for (size_t h = 0; h < HOLDS; h++)
+			printf("%-10s %8.0f %+8.1f %8.1f %8.2f %8.1f\n", loops[l], holds[h], overshoot[h], settle[h], error[h], plate[h]);
+	}
+
+	// dead time compensation on a slow probe
+	Model::Params_t m = identify(SLOW_PROBE, false, false);
+	printf("\nmodel: K=%.1f*C tau=%.1fs dead=%.1fs, %u fits\n", m.gain, m.tau, m.dead, m.fits);
+	printf("%-10s %8s %8s %8s %8s\n", "gains", "target", "over", "settle", "error");
+	for (int k = 0; k < 3; k++) {
+		double overshoot[HOLDS], settle[HOLDS], error[HOLDS];
+		predicted(k ? tight : find("default"), k == 2 ? &m : NULL, overshoot, settle, error);
+		for (size_t h = 0; h < HOLDS; h++)
+			printf("%-10s %8.0f %+8.1f %8.1f %8.2f\n", k == 0 ? "default" : k == 1 ? "tight" : "smith", holds[h], overshoot[h], settle[h], error[h]);
+	}
+	return 0;
+}
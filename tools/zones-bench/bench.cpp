@@ -0,0 +1,156 @@
+// zones-bench: time per control tick for the struct-of-arrays Zones of
+// src/Zones.cpp against the same work done zone by zone, with each zone's
+// state and objects kept together in one struct.
+//
+//   make run
+//
+// src/Zones.cpp is compiled as it is, against the host stand-ins for
+// Config, ControllerBase, MAX31855 and Arduino in host/. A tick is what
+// ControllerBase does per measurement: measure, compute, log, drive, write
+// and check every zone.
+
+#include <stdio.h>
+#include <time.h>
+#include <PID_v10.h>
+#include "Zones.h"
+#include "ControllerBase.h"
+
+unsigned long bench_micros = 0;
+volatile uint8_t pins[64];
+HostSerial Serial;
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define TICKS 200000
+// ms between two ticks, the PID's sample time so every tick computes
+#define TICK_MS SAMPLE_MIN
+#define WINDOW 1000.0f
+
+// keeps the compiler from dropping the work
+static volatile int sink;
+
+// the per zone layout: everything about a zone in one place, stepped
+// through all stages before the next zone
+struct Zone {
+	MAX31855 sensor;
+	PID pid;
+	double temperature, target, control, duty;
+	float offset;
+	bool heater;
+	unsigned long last_off;
+	float history[ZONE_HISTORY];
+	uint8_t relay;
+
+	Zone(uint8_t clk, uint8_t cs, uint8_t data, uint8_t relay) :
+		sensor(clk, cs, data),
+		pid(&temperature, &control, &target, 0, 0, 0, DIRECT),
+		temperature(0), target(DEFAULT_TARGET), control(0), duty(0), offset(0),
+		heater(false), last_off(0), relay(relay) {
+		sensor.begin();
+		pid.SetSampleTime(SAMPLE_MIN * 1000);
+		pid.SetMode(AUTOMATIC);
+		pid.SetOutputLimits(0, 1);
+		pinMode(relay, OUTPUT);
+		digitalWrite(relay, LOW);
+	}
+
+	int tick(unsigned long now, double t, uint16_t head, unsigned long phase) {
+		sensor.read();
+		temperature = sensor.getTemperature();
+		target = t + offset;
+		pid.Compute(now * 1000);
+		control = max(control, 0.0);
+		history[head] = temperature;
+		if (phase == 0)
+			duty = control;
+		heater = (phase < WINDOW * duty && duty > CONTROL_HYSTERISIS) ||
+			(phase >= WINDOW * duty && duty > 1.0 - CONTROL_HYSTERISIS);
+		digitalWrite(relay, heater);
+		if (!heater) {
+			last_off = now;
+			return 0;
+		}
+		if (isnan(temperature))
+			return Faults::PROBE;
+		if (temperature > MAX_TEMPERATURE)
+			return Faults::OVER_TEMPERATURE;
+		if (now - last_off > MAX_ON_TIME && temperature > SAFE_TEMPERATURE)
+			return Faults::HEATER_TIME;
+		return 0;
+	}
+};
+
+static double per_zone(uint8_t count) {
+	Zone * zones[ZONES_MAX];
+	for (uint8_t z = 0; z < count; z++) {
+		zones[z] = new Zone(14, 20 + z, 12, 30 + z);
+		zones[z]->offset = z;
+		zones[z]->pid.Retune(.03, .0003, .1);
+	}
+	bench_micros = 0;
+	uint16_t head = 0;
+	double start = now_ns();
+	for (int i = 0; i < TICKS; i++) {
+		unsigned long now = (i + 1) * TICK_MS;
+		bench_micros = now * 1000;
+		int fault = 0;
+		for (uint8_t z = 0; z < count; z++)
+			fault |= zones[z]->tick(now, 150, head, now % (unsigned long)WINDOW);
+		head = (head + 1) % ZONE_HISTORY;
+		sink = fault;
+	}
+	double ns = (now_ns() - start) / TICKS;
+	for (uint8_t z = 0; z < count; z++)
+		delete zones[z];
+	return ns;
+}
+
+static double arrays(uint8_t count) {
+	Config config;
+	config.zone_count = count;
+	for (uint8_t z = 0; z < count; z++) {
+		config.zones[z].name = "zone";
+		config.zones[z].cs = 20 + z;
+		config.zones[z].relay = 30 + z;
+	}
+	Zones zones(config);
+	zones.begin(14, 12);
+	float offsets[ZONES_MAX];
+	for (uint8_t z = 0; z < count; z++)
+		offsets[z] = z;
+	zones.offsets(offsets);
+	zones.tune(.03, .0003, .1);
+	bench_micros = 0;
+	double start = now_ns();
+	for (int i = 0; i < TICKS; i++) {
+		unsigned long now = (i + 1) * TICK_MS;
+		bench_micros = now * 1000;
+		zones.measure(now);
+		zones.compute(now, 150);
+		zones.log();
+		unsigned long phase = now % (unsigned long)WINDOW;
+		if (phase == 0)
+			zones.latch();
+		zones.drive(Zones::CONTROL, phase, WINDOW);
+		zones.write();
+		Faults::FAULT_t fault = Faults::NONE;
+		sink = zones.check(now, fault);
+	}
+	return (now_ns() - start) / TICKS;
+}
+
+int main() {
+	printf("%d ticks\n\n", TICKS);
+	printf("%-6s %10s %10s\n", "", "per zone", "arrays");
+	printf("%-6s %10s %10s\n", "zones", "ns/tick", "ns/tick");
+	for (uint8_t count = 1; count <= ZONES_MAX; count *= 2) {
+		double old = per_zone(count);
+		double soa = arrays(count);
+		printf("%-6u %10.1f %10.1f   %5.2fx\n", count, old, soa, old / soa);
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// just enough of the Arduino API for src/Zones.cpp and the PID library
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define OUTPUT 1
+#define LOW 0
+
+typedef std::string String;
+
+// relay pins, written but never read back
+extern volatile uint8_t pins[64];
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) { pins[pin] = value; }
+
+extern unsigned long bench_micros;
+inline unsigned long micros() { return bench_micros; }
+inline unsigned long millis() { return bench_micros / 1000; }
+
+struct HostSerial {
+	void println(const char *) {}
+	void print(const char *) {}
+};
+extern HostSerial Serial;
+
+#endif
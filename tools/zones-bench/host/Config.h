@@ -0,0 +1,21 @@
+#ifndef HOST_CONFIG_H
+#define HOST_CONFIG_H
+
+#include <Arduino.h>
+
+// the zone part of src/Config.h
+#define ZONES_MAX 8
+
+class Config {
+public:
+	typedef struct {
+		std::string name;
+		uint8_t cs;
+		uint8_t relay;
+	} Zone_t;
+
+	Zone_t zones[ZONES_MAX];
+	uint8_t zone_count;
+};
+
+#endif
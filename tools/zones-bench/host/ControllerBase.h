@@ -0,0 +1,14 @@
+#ifndef HOST_CONTROLLER_BASE_H
+#define HOST_CONTROLLER_BASE_H
+
+// what src/Zones.cpp uses of src/ControllerBase.h and src/Sampler.h
+#define DEFAULT_TARGET 60
+#define MAX_ON_TIME 1000 * 60 * 2
+#define MAX_TEMPERATURE 400
+#define CONTROL_HYSTERISIS .01
+#define SAFE_TEMPERATURE 50
+#define SAMPLE_MIN 100
+
+inline void S_printf(const char * format, ...) {}
+
+#endif
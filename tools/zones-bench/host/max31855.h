@@ -0,0 +1,18 @@
+#ifndef HOST_MAX31855_H
+#define HOST_MAX31855_H
+
+#include <Arduino.h>
+
+// a thermocouple that reads a slowly moving temperature instead of SPI
+class MAX31855 {
+public:
+	MAX31855(uint8_t clk, uint8_t cs, uint8_t data) : _cs(cs), _temperature(20 + cs) {}
+	void begin() {}
+	void read() { _temperature += _temperature < 250 ? .25 : -200; }
+	double getTemperature() { return _temperature; }
+private:
+	uint8_t _cs;
+	double _temperature;
+};
+
+#endif
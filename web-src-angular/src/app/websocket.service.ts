@@ -38,6 +38,9 @@ export class WebsocketService {
 
 	heater = false;
 
+	// sequence number of the last reading we have, 0 for none
+	last_seq = 0;
+
 	messages = new MessageDatabase;
 
 	onReadings = () => {};
@@ -73,6 +76,14 @@ export class WebsocketService {
 		this.send("REBOOT");
 	}
 
+	public acknowledge_fault() {
+		this.send("FAULT-ACK");
+	}
+
+	public clear_fault() {
+		this.send("FAULT-CLEAR");
+	}
+
 	public download_temperature_log() {
 		var data, link;
 		var readings = this.readings.readings;
@@ -102,7 +113,8 @@ export class WebsocketService {
 
 		this.ws.onopen = () =>
 		{
-			this.send("WATCHDOG");
+			// only ask for the readings we have missed
+			this.send("resync:" + this.last_seq);
 			this.onConnect();
 		};
 
@@ -125,7 +137,13 @@ export class WebsocketService {
 				if (data.readings && data.times) {
 					if (data.reset) {
 						this.reset_readings();
+					} else if (data.seq && this.last_seq && data.seq - data.readings.length > this.last_seq) {
+						// readings went missing, fetch the gap
+						this.send("resync:" + this.last_seq);
+						return;
 					}
+					if (data.seq)
+						this.last_seq = data.seq;
 					this.readings.times = this.readings.times.concat(data.times);
 					this.readings.readings[0].data = this.readings.readings[0].data.concat(data.readings);
 					this.readings.readings[1].data = this.readings.readings[1].data.concat(data.targets);